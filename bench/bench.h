@@ -0,0 +1,38 @@
+#ifndef POLL_EVENT_BENCH_H
+#define POLL_EVENT_BENCH_H
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+// What every benchmark needs: one clock, a way to fail a check and a rate
+// printed the same way everywhere. A failed check exits with 1, so a bench
+// run by hand or from a script stops at the first wrong answer.
+namespace bench
+{
+typedef std::chrono::steady_clock steady;
+
+inline double seconds_since(steady::time_point start)
+{
+    return std::chrono::duration<double>(steady::now() - start).count();
+}
+inline double millis_since(steady::time_point start)
+{
+    return seconds_since(start) * 1e3;
+}
+// `n` is what the check was about: an index, a size, a count
+[[noreturn]] inline void fail(const char *what, size_t n)
+{
+    printf("FAILED: %s (%lu)\n", what, n);
+    exit(1);
+}
+// "<what>: <count / seconds> <unit>/s", scaled to millions past a million
+inline void rate(const char *what, double count, const char *unit, double seconds)
+{
+    double perSecond = count / seconds;
+    if (perSecond >= 1e6) printf("%s: %.2f M %s/s (%.2f s)\n", what, perSecond / 1e6, unit, seconds);
+    else printf("%s: %.1f %s/s (%.2f s)\n", what, perSecond, unit, seconds);
+}
+}
+
+#endif //POLL_EVENT_BENCH_H
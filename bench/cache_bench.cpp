@@ -0,0 +1,102 @@
+#include <cstdio>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/thread/mutex.hpp>
+#include "../refactor/concurrent_cache.h"
+#include "../refactor/lrucache.h"
+#include "bench.h"
+
+// Threads looking up skewed URL keys, putting the missing ones, against
+// concurrent_cache and against lru_cache behind one mutex. Reports lookups
+// per second and the hit ratio, so CLOCK's approximation of LRU is measured
+// along with its locking.
+namespace
+{
+    using bench::steady;
+    using bench::fail;
+
+    const size_t capacity = 10000;
+    const size_t universe = 100000; // distinct keys
+    const size_t lookups = 250000; // per thread
+    const size_t threadCounts[] = {1, 2, 4, 8};
+
+    // A few keys are hot and most are cold, like requests to one proxy
+    std::vector<std::string> make_keys(unsigned seed)
+    {
+        std::mt19937 random(seed);
+        std::uniform_real_distribution<double> u(0, 1);
+        std::vector<std::string> keys(lookups);
+        for (auto &key : keys) {
+            double x = u(random);
+            key = "example.com/object/" + std::to_string(static_cast<size_t>(universe * x * x * x));
+        }
+        return keys;
+    }
+    struct locked_lru
+    {
+        locked_lru()
+            : lru(capacity){}
+        bool find(const std::string &key)
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            return lru.find(key) != nullptr;
+        }
+        void put(const std::string &key, int value)
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            lru.put(key, value);
+        }
+        boost::mutex mutex;
+        cache::lru_cache<std::string, int> lru;
+    };
+    struct sharded
+    {
+        sharded()
+            : clock(capacity){}
+        bool find(const std::string &key)
+        { return static_cast<bool>(clock.find(key)); }
+        void put(const std::string &key, int value)
+        { clock.put(key, value); }
+        cache::concurrent_cache<std::string, int> clock;
+    };
+    template<typename cache_t>
+    void run(const char *name, size_t threads, const std::vector<std::vector<std::string>> &keys)
+    {
+        cache_t c;
+        std::vector<size_t> hits(threads);
+        std::vector<std::thread> workers;
+        auto start = steady::now();
+        for (size_t t = 0; t < threads; t++) {
+            workers.emplace_back([&c, &hits, &keys, t]
+                                 {
+                                     for (auto &key : keys[t]) {
+                                         if (c.find(key)) hits[t]++;
+                                         else c.put(key, 1);
+                                     }
+                                 });
+        }
+        for (auto &w : workers) w.join();
+        double took = bench::seconds_since(start);
+        size_t hit = 0;
+        for (size_t h : hits) hit += h;
+        if (hit == 0 || hit >= threads * lookups) fail("implausible hit count", hit);
+        char what[64];
+        snprintf(what, sizeof what, "%s, %lu threads, hit ratio %.3f", name, threads,
+                 static_cast<double>(hit) / (threads * lookups));
+        bench::rate(what, threads * lookups, "lookups", took);
+    }
+}
+
+int main()
+{
+    std::vector<std::vector<std::string>> keys;
+    for (size_t t = 0; t < threadCounts[3]; t++) keys.push_back(make_keys(static_cast<unsigned>(t)));
+    printf("%lu entries, %lu keys, %u cores\n", capacity, universe, std::thread::hardware_concurrency());
+    for (size_t threads : threadCounts) {
+        run<locked_lru>("lru_cache+mutex", threads, keys);
+        run<sharded>("concurrent_cache", threads, keys);
+    }
+    return 0;
+}
@@ -0,0 +1,144 @@
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <string>
+#include <vector>
+#include "../refactor/http_scan.h"
+#include "../refactor/HTTP.h"
+#include "bench.h"
+
+// http_scan::find against a byte-at-a-time loop over the same stop sets, on
+// the request and response heads in bench/corpus. Each head is scanned the
+// way the parser does it, line by line, and then parsed whole. Random inputs
+// are checked against the loop first, so a fast scan that stops in the wrong
+// place fails instead of winning.
+namespace
+{
+    using bench::steady;
+    using bench::fail;
+    typedef const char *(*scan_fn)(const char *, const char *, const http_scan::stop_set &);
+
+    const size_t scanned = 64 << 20; // bytes per measurement
+
+    const char *find_scalar(const char *p, const char *end, const http_scan::stop_set &set)
+    {
+        for (; p != end; ++p) {
+            unsigned char c = static_cast<unsigned char>(*p);
+            for (size_t i = 0; i + 1 < set.size; i += 2) {
+                if (c >= static_cast<unsigned char>(set.ranges[i]) && c <= static_cast<unsigned char>(set.ranges[i + 1]))
+                    return p;
+            }
+        }
+        return end;
+    }
+    void check_against_scalar()
+    {
+        const http_scan::stop_set *sets[] = {&http_scan::token, &http_scan::uri, &http_scan::name, &http_scan::value};
+        std::mt19937 random(7);
+        std::uniform_int_distribution<int> byte(0, 255), printable(0x21, 0x7e), length(0, 100);
+        for (size_t i = 0; i < 100000; i++) {
+            std::string text(length(random), ' ');
+            for (auto &c : text) c = static_cast<char>(printable(random));
+            if (!text.empty() && i % 2) text[length(random) % text.size()] = static_cast<char>(byte(random));
+            const http_scan::stop_set &set = *sets[i % 4];
+            const char *begin = text.data(), *end = begin + text.size();
+            if (http_scan::find(begin, end, set) != find_scalar(begin, end, set)) fail("find() disagrees with the loop", i);
+        }
+    }
+    // Heads are paragraphs of LF-terminated lines, '#' lines are comments
+    std::vector<std::string> load(const std::string &path)
+    {
+        std::ifstream in(path);
+        if (!in) fail(("cannot read " + path).c_str(), 0);
+        std::vector<std::string> heads;
+        std::string line, head;
+        while (std::getline(in, line)) {
+            if (!line.empty() && line[0] == '#') continue;
+            if (!line.empty()) {
+                head += line + "\r\n";
+                continue;
+            }
+            if (!head.empty()) heads.push_back(head + "\r\n");
+            head.clear();
+        }
+        if (!head.empty()) heads.push_back(head + "\r\n");
+        if (heads.empty()) fail(("no heads in " + path).c_str(), 0);
+        return heads;
+    }
+    // The scans the parser makes over a head: the first line's three parts,
+    // then every header's name and value. Returns the bytes the scans stopped at
+    size_t scan_head(const std::string &head, scan_fn find, const http_scan::stop_set &second,
+                     const http_scan::stop_set &third)
+    {
+        const char *p = head.data(), *end = p + head.size() - 2;
+        size_t stops = 0;
+        const char *space = find(p, end, http_scan::token);
+        space = find(space + 1, end, second);
+        const char *crlf = find(space + 1, end, third);
+        for (p = crlf + 2; p < end;) {
+            const char *colon = find(p, end, http_scan::name);
+            const char *value = colon + 1;
+            while (*value == ' ') value++;
+            crlf = find(value, end, http_scan::value);
+            stops += colon - p + crlf - value;
+            p = crlf + 2;
+        }
+        return stops;
+    }
+    struct corpus
+    {
+        const char *name;
+        std::vector<std::string> heads;
+        bool requests;
+        size_t bytes() const
+        {
+            size_t total = 0;
+            for (auto &head : heads) total += head.size();
+            return total;
+        }
+    };
+    // ns per head to scan every head of the corpus with `find`
+    double scan(const corpus &c, scan_fn find, size_t *stops)
+    {
+        const http_scan::stop_set &second = c.requests ? http_scan::uri : http_scan::token;
+        const http_scan::stop_set &third = c.requests ? http_scan::token : http_scan::value;
+        size_t rounds = scanned / c.bytes();
+        *stops = 0;
+        auto start = steady::now();
+        for (size_t i = 0; i < rounds; i++) {
+            for (auto &head : c.heads) *stops += scan_head(head, find, second, third);
+        }
+        return bench::seconds_since(start) * 1e9 / (rounds * c.heads.size());
+    }
+    double parse(const corpus &c)
+    {
+        size_t rounds = scanned / c.bytes() / 8;
+        auto start = steady::now();
+        for (size_t i = 0; i < rounds; i++) {
+            for (auto &head : c.heads) {
+                int state = c.requests ? request(head).get_state() : response(head).get_state();
+                if (state < HTTP::HEADERS) fail("a corpus head did not parse", i);
+            }
+        }
+        return bench::seconds_since(start) * 1e9 / (rounds * c.heads.size());
+    }
+}
+
+int main(int argc, char **argv)
+{
+    std::string dir = argc > 1 ? argv[1] : CORPUS_DIR;
+    check_against_scalar();
+    printf("http_scan uses %s\n", http_scan::implementation());
+
+    corpus corpora[] = {{"requests", load(dir + "/requests.txt"), true},
+                        {"responses", load(dir + "/responses.txt"), false}};
+    for (auto &c : corpora) {
+        size_t scalarStops, simdStops;
+        double scalar = scan(c, find_scalar, &scalarStops);
+        double simd = scan(c, http_scan::find, &simdStops);
+        if (scalarStops != simdStops) fail("find() stopped elsewhere than the loop", scalarStops);
+        printf("%lu %s, %lu bytes: scan with the loop %.0f ns/head, with find %.0f ns/head, %.2fx; parse %.0f ns/head\n",
+               c.heads.size(), c.name, c.bytes() / c.heads.size(), scalar, simd, scalar / simd, parse(c));
+    }
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <string>
+#include "../refactor/HTTP.h"
+#include "bench.h"
+
+// Responses from 1 MB to 64 MB fed to the parser in 64 KB reads, the way the
+// proxy appends them, with Content-Length and chunked framing. The cost per
+// byte has to stay flat as the response grows; a parser that rescans or
+// copies what it already has gets slower per byte with every size.
+namespace
+{
+    using bench::steady;
+    using bench::fail;
+
+    const size_t readSize = 64 * 1024;
+    const size_t smallest = 1 << 20;
+    const size_t largest = 64 << 20;
+    const double allowedGrowth = 4; // per-byte cost, largest against smallest
+
+    // The whole response as it comes off the wire, headers included
+    std::string make_response(size_t size, bool chunked)
+    {
+        std::string text = "HTTP/1.1 200 OK\r\nContent-Type: application/octet-stream\r\n";
+        if (!chunked) {
+            text += "Content-Length: " + std::to_string(size) + "\r\n\r\n";
+            text.append(size, 'x');
+            return text;
+        }
+        text += "Transfer-Encoding: chunked\r\n\r\n";
+        char line[32];
+        for (size_t left = size; left;) {
+            size_t chunk = std::min(left, readSize - 16); // chunk lines straddle the reads
+            snprintf(line, sizeof line, "%lx\r\n", chunk);
+            text += line;
+            text.append(chunk, 'x');
+            text += "\r\n";
+            left -= chunk;
+        }
+        text += "0\r\n\r\n";
+        return text;
+    }
+    // Seconds to parse `wire` read by read
+    double parse(const std::string &wire, size_t size)
+    {
+        size_t headers = wire.find("\r\n\r\n") + 4;
+        auto start = steady::now();
+        response resp(wire.substr(0, headers));
+        for (size_t pos = headers; pos < wire.size(); pos += readSize) {
+            if (resp.get_state() == HTTP::BODYFULL) fail("complete before the last read", size);
+            resp.add_part(wire.data() + pos, std::min(readSize, wire.size() - pos));
+        }
+        double took = bench::seconds_since(start);
+        if (resp.get_state() != HTTP::BODYFULL) fail("not complete after the last read", size);
+        return took;
+    }
+    void run(bool chunked)
+    {
+        double first = 0;
+        for (size_t size = smallest; size <= largest; size *= 4) {
+            std::string wire = make_response(size, chunked);
+            double took = parse(wire, size);
+            double perByte = took * 1e9 / size;
+            std::string what = (chunked ? "chunked, " : "content-length, ") + std::to_string(size >> 20) + " MB";
+            bench::rate(what.c_str(), size >> 20, "MB", took);
+            if (!first) first = perByte;
+            else if (perByte > first * allowedGrowth) fail("cost per byte grows with the size", size);
+        }
+    }
+}
+
+int main()
+{
+    run(false);
+    run(true);
+    return 0;
+}
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <random>
+#include <vector>
+#include "../refactor/timer.h"
+#include "bench.h"
+
+// A million connections' idle timeouts: armed, recharged as traffic arrives,
+// then left to expire while the clock runs in 10 ms steps like the event loop.
+// Checks that top() never lies past the next expiration and that each timer
+// fires in the tick of its deadline.
+namespace
+{
+    using bench::steady;
+    using bench::millis_since;
+    using bench::fail;
+
+    const size_t count = 1000000;
+    const auto idle = std::chrono::seconds(30);
+    const auto step = std::chrono::milliseconds(10);
+    const auto tick = std::chrono::milliseconds(1);
+
+    // A timer left on level 2 expires before a later one on level 1 is
+    // cascaded: top() has to look past the first occupied level
+    void check_levels()
+    {
+        io::timer::timer_service service;
+        steady::time_point start = steady::now();
+        io::timer::timer_element early(service, start + std::chrono::milliseconds(65600), [] {});
+        service.process(start + std::chrono::milliseconds(65000));
+        io::timer::timer_element late(service, start + std::chrono::milliseconds(71000), [] {});
+        if (service.top() > start + std::chrono::milliseconds(65600) + tick) fail("top() skipped a level", 0);
+    }
+}
+
+int main()
+{
+    check_levels();
+
+    io::timer::timer_service service;
+    std::unique_ptr<io::timer::timer_element[]> timers(new io::timer::timer_element[count]);
+    std::vector<steady::time_point> wake(count);
+    std::vector<steady::time_point> fired(count);
+    steady::time_point now = steady::now();
+    std::mt19937 random(42);
+    std::uniform_int_distribution<int> jitter(0, 90000); // longer timeouts for some
+
+    auto start = steady::now();
+    for (size_t i = 0; i < count; i++) {
+        timers[i].setParent(&service);
+        timers[i].setCallback([&fired, &now, i] { fired[i] = now; });
+        wake[i] = now + idle;
+        timers[i].recharge(wake[i]);
+    }
+    bench::rate("arm", count, "timers", bench::seconds_since(start));
+
+    start = steady::now();
+    for (size_t i = 0; i < count; i++) {
+        wake[i] = now + idle + std::chrono::milliseconds(jitter(random));
+        timers[i].recharge(wake[i]);
+    }
+    bench::rate("recharge", count, "timers", bench::seconds_since(start));
+
+    std::vector<size_t> order(count);
+    for (size_t i = 0; i < count; i++) order[i] = i;
+    std::sort(order.begin(), order.end(), [&wake](size_t a, size_t b) { return wake[a] < wake[b]; });
+
+    size_t next = 0, steps = 0;
+    double process = 0, top = 0;
+    steady::time_point end = wake[order.back()] + step;
+    while (now < end) {
+        now += step;
+        steps++;
+        start = steady::now();
+        service.process(now);
+        process += millis_since(start);
+        // deadlines are rounded up to the next millisecond tick
+        for (; next < count && wake[order[next]] + tick <= now; next++) {
+            if (timers[order[next]].armed()) fail("not fired by its deadline", order[next]);
+            if (fired[order[next]] < wake[order[next]]) fail("fired early", order[next]);
+            if (fired[order[next]] - wake[order[next]] > step + tick) fail("fired late", order[next]);
+        }
+        if (service.empty()) break;
+        start = steady::now();
+        steady::time_point bound = service.top();
+        top += millis_since(start);
+        if (next < count && bound > wake[order[next]] + tick) {
+            fail("top() is past the next expiration", order[next]);
+        }
+    }
+    if (next != count || !service.empty()) fail("timers left", next);
+    printf("expire %lu timers over %lu steps: process %.1f ms, top %.1f ms\n", count, steps, process, top);
+    return 0;
+}
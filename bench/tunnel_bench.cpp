@@ -0,0 +1,157 @@
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../refactor/io_service.h"
+#include "../refactor/proxy_server.h"
+#include "bench.h"
+
+// Bytes pushed through CONNECT tunnels to an echo origin on this host and
+// read back, one tunnel and then several at once. The proxy runs its loop
+// on the main thread, origin and clients on threads of their own. Every
+// byte that comes back is checked, so a relay that drops or reorders fails.
+namespace
+{
+    using bench::steady;
+    using bench::fail;
+
+    const size_t block = 64 * 1024;
+    const size_t single = 256 << 20; // bytes through one tunnel
+    const size_t parallel = 8;
+    const size_t each = 32 << 20; // bytes through each of the parallel ones
+
+    char pattern(size_t offset)
+    {
+        return static_cast<char>(offset % 251);
+    }
+    int listenLocal(uint16_t *port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof addr;
+        if (fd == -1 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == -1 || listen(fd, 16) == -1
+            || getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) == -1) {
+            perror("origin");
+            exit(1);
+        }
+        *port = ntohs(addr.sin_port);
+        return fd;
+    }
+    int connectLocal(uint16_t port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (fd == -1 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == -1) {
+            perror("client");
+            exit(1);
+        }
+        return fd;
+    }
+    void echo(int fd)
+    {
+        char buffer[block];
+        ssize_t res;
+        while ((res = read(fd, buffer, sizeof buffer)) > 0) {
+            for (ssize_t sent = 0, n; sent < res; sent += n) {
+                if ((n = write(fd, buffer + sent, res - sent)) <= 0) {
+                    close(fd);
+                    return;
+                }
+            }
+        }
+        close(fd);
+    }
+    void runOrigin(int listener)
+    {
+        for (;;) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd == -1) return;
+            std::thread(echo, fd).detach();
+        }
+    }
+    // A client connection with the tunnel to the origin open
+    int openTunnel(uint16_t proxy, uint16_t origin)
+    {
+        int fd = connectLocal(proxy);
+        std::string connect = "CONNECT 127.0.0.1:" + std::to_string(origin) + " HTTP/1.1\r\nHost: 127.0.0.1:"
+            + std::to_string(origin) + "\r\n\r\n";
+        if (write(fd, connect.data(), connect.size()) != static_cast<ssize_t>(connect.size())) fail("CONNECT", 0);
+        std::string reply;
+        char c;
+        while (reply.find("\r\n\r\n") == reply.npos) {
+            if (read(fd, &c, 1) != 1) fail("no reply to CONNECT", reply.size());
+            reply += c;
+        }
+        if (reply.compare(0, 12, "HTTP/1.1 200") != 0) fail("CONNECT refused", 0);
+        return fd;
+    }
+    // Writes `total` bytes on one thread while this one reads them back
+    void pump(int fd, size_t total)
+    {
+        std::thread writer([fd, total]
+                           {
+                               char buffer[block];
+                               for (size_t sent = 0; sent < total;) {
+                                   size_t n = std::min(block, total - sent);
+                                   for (size_t i = 0; i < n; i++) buffer[i] = pattern(sent + i);
+                                   ssize_t res = write(fd, buffer, n);
+                                   if (res <= 0) fail("tunnel write", sent);
+                                   sent += res;
+                               }
+                           });
+        char buffer[block];
+        for (size_t received = 0; received < total;) {
+            ssize_t res = read(fd, buffer, sizeof buffer);
+            if (res <= 0) fail("tunnel closed early", received);
+            for (ssize_t i = 0; i < res; i++) {
+                if (buffer[i] != pattern(received + i)) fail("tunnel corrupted a byte at", received + i);
+            }
+            received += res;
+        }
+        writer.join();
+        close(fd);
+    }
+}
+
+int main()
+{
+    uint16_t originPort;
+    int listener = listenLocal(&originPort);
+    std::thread(runOrigin, listener).detach();
+
+    io::io_service ep;
+    proxy_server server(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")));
+    uint16_t proxyPort = server.local_endpoint().port();
+
+    std::thread client([&server, originPort, proxyPort]
+                       {
+                           auto start = steady::now();
+                           pump(openTunnel(proxyPort, originPort), single);
+                           bench::rate("1 tunnel", single >> 20, "MB", bench::seconds_since(start));
+
+                           start = steady::now();
+                           std::vector<std::thread> tunnels;
+                           for (size_t i = 0; i < parallel; i++) {
+                               int fd = openTunnel(proxyPort, originPort);
+                               tunnels.emplace_back([fd] { pump(fd, each); });
+                           }
+                           for (auto &t : tunnels) t.join();
+                           bench::rate((std::to_string(parallel) + " tunnels").c_str(), (parallel * each) >> 20, "MB",
+                                       bench::seconds_since(start));
+                           server.shutdown();
+                       });
+    ep.run();
+    client.join();
+    return 0;
+}
@@ -2,25 +2,94 @@
 // Created by kamenev on 13.12.15.
 //
 
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <strings.h>
 #include "HTTP.h"
+#include "http_scan.h"
 #include "debug.h"
+#include "utils.h"
+constexpr const long response::heuristicLimit;
+// Value of a Cache-Control directive, e.g. max-age. Directive names are
+// case-insensitive; a directive without a value reads as 0.
+static bool cache_directive(const std::string &header, const char *name, long *value)
+{
+    size_t length = strlen(name);
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t comma = header.find(',', pos);
+        if (comma == header.npos) comma = header.size();
+        while (pos < comma && (header[pos] == ' ' || header[pos] == '\t')) pos++;
+        if (comma - pos >= length && strncasecmp(header.c_str() + pos, name, length) == 0
+            && (pos + length == comma || header[pos + length] == '=' || header[pos + length] == ' ')) {
+            size_t eq = header.find('=', pos + length);
+            *value = 0;
+            if (eq != header.npos && eq < comma) {
+                const char *number = header.c_str() + eq + 1;
+                if (*number == '"') number++;
+                *value = std::max(0L, strtol(number, nullptr, 10));
+            }
+            return true;
+        }
+        pos = comma + 1;
+    }
+    return false;
+}
+// Whether a Connection header lists `option`; options are comma-separated
+// tokens, compared case-insensitively
+static bool connection_option(const std::string &header, const char *option)
+{
+    size_t length = strlen(option);
+    size_t pos = 0;
+    while (pos < header.size()) {
+        size_t comma = header.find(',', pos);
+        if (comma == header.npos) comma = header.size();
+        size_t end = comma;
+        while (pos < end && (header[pos] == ' ' || header[pos] == '\t')) pos++;
+        while (end > pos && (header[end - 1] == ' ' || header[end - 1] == '\t')) end--;
+        if (end - pos == length && strncasecmp(header.c_str() + pos, option, length) == 0) return true;
+        pos = comma + 1;
+    }
+    return false;
+}
+static bool keep_alive(const std::string &version, const std::string &connection)
+{
+    if (connection_option(connection, "close")) return false;
+    return version == "HTTP/1.1" || connection_option(connection, "keep-alive");
+}
 void HTTP::add_part(std::string string)
 {
-    text.append(string);
+    add_part(string.data(), string.size());
+}
+void HTTP::add_part(const char *data, size_t size)
+{
+    text.append(data, size);
     update_state();
 }
 void HTTP::update_state()
 {
-    if (state == 0 && text.find("\r\n") != std::string::npos) {
+    // Every search resumes at `scanned`, so each byte is looked at a bounded
+    // number of times however the message is split into parts.
+    if (state == BEFORE) {
+        size_t eol = text.find("\r\n", scanned);
+        if (eol == std::string::npos) {
+            scanned = text.empty() ? 0 : text.size() - 1;
+            return;
+        }
         state = FIRSTLINE;
+        scanned = line_end = eol;
         parse_first_line();
     }
-    if (state == FIRSTLINE && (body_start == 0 || body_start == std::string::npos)) {
-        body_start = text.find("\r\n\r\n");
-    }
-    if (state == FIRSTLINE && body_start != std::string::npos && body_start != 0) {
+    if (state == FIRSTLINE) {
+        size_t end = text.find("\r\n\r\n", scanned);
+        if (end == std::string::npos) {
+            scanned = text.size() < 3 ? 0 : text.size() - 3;
+            return;
+        }
         state = HEADERS;
-        body_start += 4;
+        body_start = end + 4;
+        scanned = body_start;
         parse_headers();
     }
     if (state >= HEADERS) {
@@ -30,107 +99,236 @@ void HTTP::update_state()
 
 void HTTP::parse_headers()
 {
-    auto headers_start = std::find_if(text.begin(), text.end(), [](char a)
-    {
-        return a == '\n';
-    })++;
-    auto headers_end = headers_start + 1;
-
-    while (headers_end != text.end() && *headers_end != '\r') {
-        auto space = std::find_if(headers_end, text.end(), [](char a)
-        { return a == ':'; });
-        auto crlf = std::find_if(space + 1, text.end(), [](char a)
-        { return a == '\r'; });
-
-        headers.insert({{headers_end, space}, {space + 2, crlf}});
-        headers_end = crlf + 2;
+    const char *p = text.data() + line_end + 2;
+    const char *end = text.data() + body_start - 2;
+
+    while (p < end) {
+        const char *colon = http_scan::find(p, end, http_scan::name);
+        if (colon == p || colon == end || *colon != ':') {
+            state = FAIL;
+            return;
+        }
+        const char *value = colon + 1;
+        while (value < end && (*value == ' ' || *value == '\t')) value++;
+        const char *crlf = http_scan::find(value, end, http_scan::value);
+        if (crlf == end || *crlf != '\r' || crlf[1] != '\n') {
+            state = FAIL;
+            return;
+        }
+        const char *value_end = crlf;
+        while (value_end > value && (value_end[-1] == ' ' || value_end[-1] == '\t')) value_end--;
+
+        const char *base = text.data();
+        headers.push_back({nullptr, size_t(p - base), size_t(colon - p), size_t(value - base), size_t(value_end - value)});
+        p = crlf + 2;
     };
+    size_t length;
+    const char *value = header_value("Content-Length", &length);
+    if (value && !str_to_size(value, length, &content_length)) {
+        state = FAIL; // strtoul() would take "-1" or "+5"
+        content_length = std::string::npos;
+    }
+    value = header_value("Transfer-Encoding", &length);
+    if (value) {
+        // only a final chunked coding frames the body (RFC 7230 3.3.3), in any case
+        const char *last = value + length;
+        while (last > value && last[-1] != ',') last--;
+        while (last < value + length && (*last == ' ' || *last == '\t')) last++;
+        chunked = value + length - last == 7 && strncasecmp(last, "chunked", 7) == 0;
+        // Transfer-Encoding overrides Content-Length; a request carrying both, or
+        // either twice, may be framed differently upstream: it is refused
+        bool ambiguous = content_length != std::string::npos || header_count("Transfer-Encoding") > 1;
+        content_length = std::string::npos;
+        if (strict_framing() && (ambiguous || !chunked)) state = FAIL;
+    }
+    if (strict_framing() && header_count("Content-Length") > 1) state = FAIL;
+}
+size_t HTTP::header_count(const char *name) const
+{
+    size_t nameLength = strlen(name), count = 0;
+    for (auto &f : headers) {
+        if (f.nameLength == nameLength && strncasecmp(field_base(f) + f.name, name, nameLength) == 0) count++;
+    }
+    return count;
 }
 void HTTP::append_header(std::string name, std::string value)
 {
-    if (headers.find(name) == headers.end()) {
-        headers[name]=value;
+    size_t length;
+    if (header_value(name.c_str(), &length)) return;
+    if (!memory) {
+        if (!ownMemory) ownMemory = std::make_shared<arena>();
+        memory = ownMemory.get();
     }
+    char *storage = static_cast<char *>(memory->allocate(name.size() + value.size(), 1));
+    memcpy(storage, name.data(), name.size());
+    memcpy(storage + name.size(), value.data(), value.size());
+    headers.push_back({storage, 0, name.size(), name.size(), value.size()});
 }
-std::string HTTP::get_header(std::string name) const
+// First non-empty value of the header, like a map keeping the first duplicate
+const char *HTTP::header_value(const char *name, size_t *length) const
 {
-    if (headers.find(name) != headers.end()) {
-        auto value = headers.at(name);
-        return value;
+    size_t nameLength = strlen(name);
+    for (auto &f : headers) {
+        if (!f.storage && f.value + f.valueLength > text.size()) continue; // text was released
+        const char *base = field_base(f);
+        if (f.nameLength == nameLength && strncasecmp(base + f.name, name, nameLength) == 0) {
+            if (f.valueLength == 0) return nullptr;
+            *length = f.valueLength;
+            return base + f.value;
+        }
     }
-    return "";
+    return nullptr;
+}
+std::string HTTP::get_header(const char *name) const
+{
+    size_t length;
+    const char *value = header_value(name, &length);
+    return value ? std::string(value, length) : std::string();
 }
 
 void HTTP::check_body()
 {
+    size_t length = dropped + text.size() - body_start;
 
-    body = text.substr(body_start);
-
-    if (get_header("Content-Length") != "") {
-        if (body.size() == static_cast<size_t>(std::stoi(get_header("Content-Length")))) {
+    if (bodiless()) { // whatever the headers say
+        state = BODYFULL;
+        message_end = body_start;
+    }
+    else if (content_length != std::string::npos) {
+        if (length >= content_length) {
             state = BODYFULL;
+            message_end = body_start + content_length - dropped;
         }
         else {
             state = BODYPART;
         }
     }
-    else if (get_header("Transfer-Encoding") == "chunked") {
-        if (std::string(body.end() - 7, body.end()) == "\r\n0\r\n\r\n") {
+    else if (chunked) {
+        if (framed < body_start) framed = body_start;
+        framed += chunks.feed(text.data() + framed, text.size() - framed);
+        if (chunks.failed()) {
+            state = FAIL;
+        }
+        else if (chunks.done()) {
             state = BODYFULL;
+            message_end = framed;
         }
         else {
             state = BODYPART;
         }
     }
-    else if (body.size() == 0) {
+    else if (empty_without_length()) {
         state = BODYFULL;
+        message_end = body_start;
     }
     else {
-        state = FAIL;
+        state = BODYPART; // until finish_at_close()
+        close_delimited = true;
+    }
+}
+void HTTP::finish_at_close()
+{
+    if (!close_delimited || state != BODYPART) return;
+    state = BODYFULL;
+    message_end = text.size();
+}
+void HTTP::drop_body()
+{
+    if (state < HEADERS) return;
+    size_t end = state == BODYFULL ? message_end : text.size(); // bytes past the message stay
+    text.erase(body_start, end - body_start);
+    dropped += end - body_start;
+    if (framed > body_start) framed -= end - body_start;
+    if (state == BODYFULL) message_end = body_start;
+}
+std::string HTTP::take_body()
+{
+    if (state < HEADERS) return std::string();
+    std::string body(text, body_start, get_held_length());
+    drop_body();
+    return body;
+}
+void HTTP::take_excess(std::string *rest)
+{
+    rest->clear();
+    if (state != BODYFULL || text.size() <= message_end) return;
+    rest->assign(text, message_end, std::string::npos);
+    text.resize(message_end);
+}
+
+// The target with an absolute-form prefix up to the host cut off
+const char *request::target(size_t *length) const
+{
+    const char *begin = text.data() + uri, *end = begin + uri_length;
+    size_t hostLength;
+    const char *host = header_value("Host", &hostLength);
+    if (host) {
+        const char *found = std::search(begin, end, host, host + hostLength);
+        if (found != end) begin = found + hostLength;
     }
+    *length = end - begin;
+    return begin;
 }
 
 std::string request::get_URI()
 {
-    if (URI.find(host) != -1)
-        URI = URI.substr(URI.find(host) + host.size());
-    return URI;
+    size_t length;
+    const char *begin = target(&length);
+    return std::string(begin, length);
 }
 
 std::string request::get_host()
 {
-    if (host == "")
-        host = get_header("Host");
-    if (host == "")
-        host = get_header("host");
-    if (host == "")
-        throw std::runtime_error("empty host");
+    std::string host;
+    get_host(&host);
     return host;
 }
 
+void request::get_host(std::string *host)
+{
+    if (is_connect()) { // the target is host:port, Host may be missing
+        host->assign(text.data() + uri, uri_length);
+        return;
+    }
+    size_t length;
+    const char *value = header_value("Host", &length);
+    if (!value)
+        throw std::runtime_error("empty host");
+    host->assign(value, length);
+}
+
+void request::cache_key(std::string *key)
+{
+    size_t hostLength, targetLength;
+    const char *host = header_value("Host", &hostLength);
+    if (!host)
+        throw std::runtime_error("empty host");
+    const char *begin = target(&targetLength);
+    key->assign(host, hostLength).append(begin, targetLength);
+}
+
 void request::parse_first_line()
 {
-    auto first_space = std::find_if(text.begin(), text.end(), [](char a)
-    { return a == ' '; });
-    auto second_space = std::find_if(first_space + 1, text.end(), [](char a)
-    { return a == ' '; });
-    auto crlf = std::find_if(second_space + 1, text.end(), [](char a)
-    { return a == '\r'; });
+    const char *begin = text.data(), *eol = text.data() + line_end;
+    const char *first_space = http_scan::find(begin, eol, http_scan::token);
+    const char *second_space = first_space == eol ? eol : http_scan::find(first_space + 1, eol, http_scan::uri);
+    const char *crlf = second_space == eol ? eol : http_scan::find(second_space + 1, eol, http_scan::token);
 
-    if (first_space == text.end() || second_space == text.end() || crlf == text.end()) {
+    if (first_space == eol || *first_space != ' ' || second_space == eol || *second_space != ' ' || crlf != eol) {
         state = FAIL;
         return;
     }
 
-    method = {text.begin(), first_space};
-    URI = {first_space + 1, second_space};
-    http_version = {second_space + 1, crlf};
+    method.assign(begin, first_space);
+    uri = first_space + 1 - begin;
+    uri_length = second_space - (first_space + 1);
+    http_version.assign(second_space + 1, crlf);
 
-    if (method != "POST" && method != "GET") {
+    if (method != "POST" && method != "GET" && method != "HEAD" && method != "CONNECT") {
         state = FAIL;
         return;
     }
-    if (URI == "") {
+    if (uri_length == 0) {
         state = FAIL;
         return;
     }
@@ -140,34 +338,68 @@ void request::parse_first_line()
     }
 }
 
-std::string request::get_request_text()
+// Serialized into the request's arena: valid as long as the request is
+const char *request::get_request_text(size_t *length)
 {
-    get_host();
-    std::string first_line = method + " " + get_URI() + " " + http_version + "\r\n";
-    std::string headers;
-    for (auto it : this->headers) {
-        if (it.first != "Proxy-Connection")
-            headers.append(it.first + ": " + it.second + "\r\n");
+    size_t hostLength;
+    if (!is_connect() && !header_value("Host", &hostLength))
+        throw std::runtime_error("empty host");
+    size_t targetLength;
+    const char *target = this->target(&targetLength);
+    auto forwarded = [this](const field &f)
+    {
+        // Expect is answered by us: the body follows as soon as it arrives
+        const char *name = field_base(f) + f.name;
+        return !(f.nameLength == 16 && strncasecmp(name, "Proxy-Connection", 16) == 0)
+            && !(f.nameLength == 6 && strncasecmp(name, "Expect", 6) == 0);
+    };
+    size_t size = method.size() + targetLength + http_version.size() + 6 + text.size() - body_start;
+    for (auto &f : headers) {
+        if (forwarded(f)) size += f.nameLength + f.valueLength + 4;
+    }
+    if (!memory) {
+        if (!ownMemory) ownMemory = std::make_shared<arena>();
+        memory = ownMemory.get();
+    }
+    char *out = static_cast<char *>(memory->allocate(size, 1)), *p = out;
+    auto append = [&p](const char *data, size_t n)
+    {
+        memcpy(p, data, n);
+        p += n;
+    };
+    append(method.data(), method.size());
+    append(" ", 1);
+    append(target, targetLength);
+    append(" ", 1);
+    append(http_version.data(), http_version.size());
+    append("\r\n", 2);
+    for (auto &f : headers) {
+        if (!forwarded(f)) continue;
+        const char *base = field_base(f);
+        append(base + f.name, f.nameLength);
+        append(": ", 2);
+        append(base + f.value, f.valueLength);
+        append("\r\n", 2);
     }
-    headers += "\r\n";
-    return first_line + headers + body;
+    append("\r\n", 2);
+    append(text.data() + body_start, text.size() - body_start);
+    *length = p - out;
+    return out;
 }
 
 void response::parse_first_line()
 {
-    auto first_space = std::find_if(text.begin(), text.end(), [](char a)
-    { return a == ' '; });
-    auto second_space = std::find_if(first_space + 1, text.end(), [](char a)
-    { return a == ' '; });
-    auto crlf = std::find_if(second_space + 1, text.end(), [](char a)
-    { return a == '\r'; });
+    const char *begin = text.data(), *eol = text.data() + line_end;
+    const char *first_space = http_scan::find(begin, eol, http_scan::token);
+    const char *second_space = first_space == eol ? eol : http_scan::find(first_space + 1, eol, http_scan::token);
+    const char *crlf = second_space == eol ? eol : http_scan::find(second_space + 1, eol, http_scan::value);
 
-    if (first_space == text.end() || second_space == text.end() || crlf == text.end()) {
+    if (first_space == eol || *first_space != ' ' || (second_space != eol && *second_space != ' ') || crlf != eol) {
         state = FAIL;
         return;
     }
 
-    http_version = {text.begin(), first_space};
+    http_version = {begin, first_space};
     code = {first_space + 1, second_space};
 
     if (http_version != "HTTP/1.1" && http_version != "HTTP/1.0") {
@@ -177,21 +409,92 @@ void response::parse_first_line()
 }
 bool request::is_validating() const
 {
-    return get_header("If-Match") != ""
-        || get_header("If-Modified-Since") != ""
-        || get_header("If-None-Match") != ""
-        || get_header("If-Range") != ""
-        || get_header("If-Unmodified-Since") != "";
+    size_t length;
+    return header_value("If-Match", &length)
+        || header_value("If-Modified-Since", &length)
+        || header_value("If-None-Match", &length)
+        || header_value("If-Range", &length)
+        || header_value("If-Unmodified-Since", &length);
+}
+
+bool request::is_no_cache() const
+{
+    long maxAge;
+    auto control = get_header("Cache-Control");
+    return cache_directive(control, "no-cache", &maxAge)
+        || (cache_directive(control, "max-age", &maxAge) && maxAge == 0)
+        || (control == "" && get_header("Pragma") == "no-cache");
+}
+
+bool request::is_keep_alive() const
+{
+    auto connection = get_header("Connection");
+    if (connection == "")
+        connection = get_header("Proxy-Connection");
+    return keep_alive(http_version, connection);
+}
+
+bool request::expects_continue() const
+{
+    return http_version == "HTTP/1.1" && strcasecmp(get_header("Expect").c_str(), "100-continue") == 0;
+}
+
+// RFC 7230 3.3.3: these end with their headers
+bool response::bodiless() const
+{
+    return toHead || code.size() != 3 || code[0] == '1' || code == "204" || code == "304";
 }
 
 bool response::is_cacheable() const
 {
-    return state == BODYFULL && checkCacheControl()
-        && get_header("ETag") != ""
+    return state == BODYFULL && is_storable();
+}
+
+bool response::is_keep_alive() const
+{
+    return keep_alive(http_version, get_header("Connection"));
+}
+
+bool response::is_storable() const
+{
+    // without a validator an entry is only useful while fresh
+    return checkCacheControl()
+        && (get_header("ETag") != "" || freshness_lifetime() > 0)
         && get_header("Vary") == ""
         && get_code() == "200";
 }
 
+// Seconds the response stays fresh in a shared cache (RFC 7234 4.2.1)
+long response::freshness_lifetime() const
+{
+    long lifetime;
+    auto control = get_header("Cache-Control");
+    if (cache_directive(control, "s-maxage", &lifetime) || cache_directive(control, "max-age", &lifetime)) {
+        return lifetime;
+    }
+    time_t date, expires, modified;
+    if (!parse_http_date(get_header("Date"), &date)) date = time(nullptr);
+    auto expiresHeader = get_header("Expires");
+    if (expiresHeader != "") {
+        // an invalid date, "0" included, means already expired
+        if (!parse_http_date(expiresHeader, &expires)) return 0;
+        return expires > date ? expires - date : 0;
+    }
+    if (parse_http_date(get_header("Last-Modified"), &modified) && modified < date) {
+        return std::min((date - modified) / 10, heuristicLimit);
+    }
+    return 0;
+}
+
+// Age when received (RFC 7234 4.2.3), ignoring the request round trip
+long response::initial_age(time_t now) const
+{
+    long age = std::max(0L, strtol(get_header("Age").c_str(), nullptr, 10));
+    time_t date;
+    if (parse_http_date(get_header("Date"), &date) && now > date) age = std::max(age, static_cast<long>(now - date));
+    return age;
+}
+
 request response::get_validating_request(std::string URI, std::string host) const
 {
     request temp("GET ");
@@ -202,7 +505,9 @@ request response::get_validating_request(std::string URI, std::string host) cons
     temp.add_part(host);
     temp.add_part("\r\n\r\n");
     LOG("Request: %s", temp.get_text().c_str());
-    LOG("Request-text: %s", temp.get_request_text().c_str());
+    size_t length;
+    const char *text = temp.get_request_text(&length);
+    LOG("Request-text: %.*s", static_cast<int>(length), text);
     return temp;
 }
 bool response::checkCacheControl() const
@@ -212,8 +517,7 @@ bool response::checkCacheControl() const
         target.find("private") == target.npos && target.find("no-cache") == target.npos &&
             target.find("no-store") == target.npos); // true = cacheable, false = non-cacheable
 }
-response::response(const response &r) : HTTP(r.text)
+response::response(const response &r) : HTTP(r.text), toHead(r.toHead)
 {
-    code = r.code;
-    http_version = r.http_version;
+    update_state(); // the headers point into our own copy of the text
 }
@@ -6,12 +6,16 @@
 #define POLL_EVENT_HTTP_H
 
 
-#include <unordered_map>
+#include <memory>
 #include <string>
+#include <vector>
+#include <ctime>
 
 #include <sstream>
 #include <regex>
 #include <iostream>
+#include "arena.h"
+#include "chunked_decoder.h"
 class HTTP
 {
 public:
@@ -61,72 +65,156 @@ public:
 
         return request;
     }
-    HTTP(std::string input)
-        : text(input)
-    { };
+    // Parse state is allocated from `memory` when given; it must outlive the message
+    HTTP(std::string input, arena *memory = nullptr)
+        : text(std::move(input)), memory(memory), headers(arena_allocator<field>(memory))
+    { headers.reserve(16); };
     void add_part(std::string);
+    void add_part(const char *, size_t);
     virtual ~HTTP()
     { };
     int get_state()
     { return state; };
-    std::string get_header(std::string) const;
+    // Header names match case-insensitively; a missing header reads as ""
+    std::string get_header(const char *name) const;
     void append_header(std::string name, std::string value);
     std::string get_body() const
-    { return body; }
+    { return state >= HEADERS ? text.substr(body_start) : std::string(); }
+    // Validated Content-Length, npos without one
+    size_t get_content_length() const
+    { return content_length; }
+    // Received so far, dropped bytes included
+    size_t get_body_length() const
+    { return state >= HEADERS ? dropped + text.size() - body_start : 0; }
+    // Frees the body received so far, for a message passed on as it arrives.
+    // Framing goes on with the bytes still to come.
+    void drop_body();
+    // Body bytes held in text, the ones drop_body() would free
+    size_t get_held_length() const
+    { return state >= HEADERS ? (state == BODYFULL ? message_end : text.size()) - body_start : 0; }
+    // Moves the body received so far out, for a message passed on as it arrives
+    std::string take_body();
     std::string get_text() const
     { return text; }
+    // Ends a body delimited by the connection closing, once it has closed
+    void finish_at_close();
+    bool is_close_delimited() const
+    { return close_delimited; }
+    // Cuts off bytes received past the end of a complete message, the start of
+    // the next one on the connection, into rest; rest is left empty if there are none
+    void take_excess(std::string *rest);
+    // Moves the raw message out; headers are views into it and read as "" afterwards
+    std::string release_text()
+    { return std::move(text); }
     enum state_t
     {
         FAIL = -1, BEFORE = 0, FIRSTLINE = 1, HEADERS = 2, BODYPART = 3, BODYFULL = 4
     };
     state_t state = BEFORE;
 protected:
+    // Header bytes live in text, or in arena memory once appended
+    struct field
+    {
+        const char *storage; // nullptr for offsets into text
+        size_t name;
+        size_t nameLength;
+        size_t value;
+        size_t valueLength;
+    };
+    const char *header_value(const char *name, size_t *length) const;
+    size_t header_count(const char *name) const;
+    const char *field_base(const field &f) const
+    { return f.storage ? f.storage : text.data(); }
     void update_state();
     void check_body();
     void parse_headers();
     virtual void parse_first_line() = 0;
+    // Whether a message with neither Content-Length nor chunked coding is complete
+    // after its headers; otherwise its body runs until the connection closes
+    virtual bool empty_without_length() const
+    { return false; }
+    // Whether the message has no body whatever its headers say
+    virtual bool bodiless() const
+    { return false; }
+    // Whether framing that only some parsers would agree on fails the message
+    virtual bool strict_framing() const
+    { return false; }
 
     size_t body_start = 0;
+    size_t message_end = 0; // valid once BODYFULL
+    size_t dropped = 0; // body bytes cut from text by drop_body()
+    size_t framed = 0; // text before this offset went through `chunks`
+    chunked_decoder chunks;
+    size_t line_end = 0; // CRLF ending the first line
+    size_t scanned = 0; // text before this offset holds no unseen delimiter
+    size_t content_length = std::string::npos;
+    bool chunked = false;
+    bool close_delimited = false;
     std::string text;
-    std::string body;
-    std::unordered_map<std::string, std::string> headers;
+    arena *memory;
+    std::shared_ptr<arena> ownMemory; // for appended headers without an arena, shared by copies
+    std::vector<field, arena_allocator<field>> headers;
 
 };
 struct request: public HTTP
 {
-    request(std::string text)
-        : HTTP(text)
+    request(std::string text, arena *memory = nullptr)
+        : HTTP(std::move(text), memory)
     { update_state(); };
 
     std::string get_method() const
     { return method; }
     std::string get_URI();
     std::string get_host();
-    std::string get_request_text();
+    // Written over host's content to reuse its buffer
+    void get_host(std::string *host);
+    // Host followed by the URI, written over key's content to reuse its buffer
+    void cache_key(std::string *key);
+    // What goes upstream, kept in the request's arena
+    const char *get_request_text(size_t *length);
 
     bool is_validating() const;
+    bool is_no_cache() const;
+    bool is_keep_alive() const;
+    bool expects_continue() const;
+    bool is_connect() const
+    { return method == "CONNECT"; }
 private:
     void parse_first_line() override;
+    bool empty_without_length() const override
+    { return true; }
+    bool strict_framing() const override
+    { return true; }
+    const char *target(size_t *length) const;
 
     std::string method;
-    std::string URI;
+    size_t uri = 0; // the request target, an offset into text
+    size_t uri_length = 0;
     std::string http_version;
-    std::string host = "";
 };
 
 struct response: public HTTP
 {
-    response(std::string text)
-        : HTTP(text)
+    // toHead: the response to a HEAD request, which never has a body
+    response(std::string text, arena *memory = nullptr, bool toHead = false)
+        : HTTP(std::move(text), memory), toHead(toHead)
     { update_state(); };
     response(const response&);
     bool is_cacheable() const;
+    bool is_storable() const;
+    bool is_keep_alive() const;
+    long freshness_lifetime() const;
+    long initial_age(time_t now) const;
     std::string get_code() const { return code; }
     request get_validating_request(std::string URI, std::string host) const;
     bool checkCacheControl() const;
+    // Heuristic freshness is a fraction of the time since Last-Modified, up to a day
+    constexpr static const long heuristicLimit = 24 * 60 * 60;
 private:
     void parse_first_line() override;
+    bool bodiless() const override;
 
+    bool toHead;
     std::string code;
     std::string http_version;
 };
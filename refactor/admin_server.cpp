@@ -0,0 +1,71 @@
+#include "admin_server.h"
+#include "debug.h"
+
+constexpr const size_t admin_server::maxRequest;
+
+constexpr const io::timer::timer_service::clock_t::duration admin_server::timeout;
+
+admin_server::admin_server(io::io_service &ep, ipv4_endpoint const &endpoint, renderer render)
+    : ios(ep), render(std::move(render)), ss{ep, endpoint, std::bind(&admin_server::on_new_connection, this)}
+{
+}
+ipv4_endpoint admin_server::local_endpoint() const
+{
+    return ss.local_endpoint();
+}
+void admin_server::on_new_connection()
+{
+    std::unique_ptr<client> cc(new client(this));
+    client *pcc = cc.get();
+    clients.emplace(pcc, std::move(cc));
+}
+admin_server::client::client(admin_server *parent)
+    : parent(parent),
+      socket(parent->ss.accept([this]
+                               {
+                                   this->parent->clients.erase(this);
+                               })),
+      timer(parent->ios.getClock(), admin_server::timeout, [this]
+      {
+          LOG("Admin client %d timed out", this->socket.getFd().get_raw());
+          this->socket.forceDisconnect();
+      })
+{
+    socket.setOn_read(std::bind(&client::handleRead, this));
+}
+void admin_server::client::handleRead()
+{
+    char buffer[1024];
+    ssize_t res = socket.read_over_connection(buffer, sizeof buffer);
+    if (res == -1) return;
+    if (res == 0) {
+        socket.forceDisconnect();
+        return;
+    }
+    request.append(buffer, res);
+    if (request.find("\r\n\r\n") == request.npos) {
+        if (request.size() > admin_server::maxRequest) socket.forceDisconnect();
+        return;
+    }
+    socket.setOn_read(connection::callback());
+    if (request.compare(0, 13, "GET /metrics ") == 0) {
+        respond("200 OK", parent->render());
+    }
+    else {
+        respond("404 Not Found", "not found\n");
+    }
+}
+void admin_server::client::respond(const char *status, const std::string &body)
+{
+    std::string head = std::string("HTTP/1.1 ") + status
+        + "\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: " + std::to_string(body.size())
+        + "\r\nConnection: close\r\n\r\n";
+    output.push(outstring(std::move(head)));
+    output.push(outstring(body));
+    socket.setOn_write(std::bind(&client::handleWrite, this));
+}
+void admin_server::client::handleWrite()
+{
+    output.flush(socket);
+    if (output.empty()) socket.forceDisconnect();
+}
@@ -0,0 +1,48 @@
+#ifndef POLL_EVENT_ADMIN_SERVER_H
+#define POLL_EVENT_ADMIN_SERVER_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include "acceptor.h"
+#include "connection.h"
+#include "output_chain.h"
+#include "timer.h"
+
+// Answers GET /metrics on its own port with whatever `render` returns, in
+// Prometheus text format; anything else gets a 404. One request per connection.
+// Runs on the loop it is given, next to the proxy it reports on.
+class admin_server
+{
+public:
+    typedef std::function<std::string()> renderer;
+    admin_server(io::io_service &, ipv4_endpoint const &, renderer render);
+    admin_server(const admin_server &) = delete;
+    admin_server &operator=(const admin_server &) = delete;
+    ipv4_endpoint local_endpoint() const;
+
+    constexpr static const size_t maxRequest = 4096;
+    constexpr static const io::timer::timer_service::clock_t::duration timeout = std::chrono::seconds(10);
+private:
+    struct client
+    {
+        client(admin_server *parent);
+        void handleRead();
+        void handleWrite();
+        void respond(const char *status, const std::string &body);
+        admin_server *parent;
+        connection socket;
+        io::timer::timer_element timer;
+        std::string request;
+        output_chain output;
+    };
+    void on_new_connection();
+    io::io_service &ios;
+    renderer render;
+    acceptor ss;
+    std::map<client *, std::unique_ptr<client>> clients;
+};
+
+
+#endif //POLL_EVENT_ADMIN_SERVER_H
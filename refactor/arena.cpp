@@ -0,0 +1,66 @@
+#include <algorithm>
+#include <cstdint>
+#include "arena.h"
+
+constexpr const size_t arena::blockSize;
+
+constexpr const size_t arena::maxRetained;
+
+arena::~arena()
+{
+    release();
+}
+arena::block *arena::newBlock(size_t size)
+{
+    block *b = static_cast<block *>(::operator new(sizeof(block) + size));
+    b->size = size;
+    b->next = blocks;
+    blocks = b;
+    offset = 0;
+    total += size;
+    return b;
+}
+void arena::release()
+{
+    while (blocks) {
+        block *next = blocks->next;
+        ::operator delete(blocks);
+        blocks = next;
+    }
+    offset = total = 0;
+}
+void *arena::allocate(size_t size, size_t alignment)
+{
+    if (blocks) {
+        char *base = reinterpret_cast<char *>(blocks + 1);
+        uintptr_t at = reinterpret_cast<uintptr_t>(base + offset);
+        size_t padding = (alignment - at % alignment) % alignment;
+        if (offset + padding + size <= blocks->size) {
+            offset += padding + size;
+            return base + offset - size;
+        }
+    }
+    // block headers keep the usable area aligned for any fundamental type
+    newBlock(std::max(blockSize, size + alignment));
+    char *base = reinterpret_cast<char *>(blocks + 1);
+    uintptr_t at = reinterpret_cast<uintptr_t>(base);
+    size_t padding = (alignment - at % alignment) % alignment;
+    offset = padding + size;
+    return base + padding;
+}
+void arena::reset()
+{
+    if (blocks && !blocks->next && blocks->size <= maxRetained) {
+        offset = 0;
+        return;
+    }
+    size_t size = std::min(total, maxRetained);
+    release();
+    if (size) newBlock(size);
+}
+size_t arena::used() const
+{
+    size_t bytes = offset;
+    for (block *b = blocks ? blocks->next : nullptr; b; b = b->next) bytes += b->size;
+    return bytes;
+}
@@ -0,0 +1,72 @@
+#ifndef POLL_EVENT_ARENA_H
+#define POLL_EVENT_ARENA_H
+
+#include <cstddef>
+#include <new>
+
+// Bump allocator for the parse state of one message. Nothing is freed on its
+// own: reset() drops everything at once when the message is done. Blocks
+// added while a large message was parsed are merged into one on reset, so
+// once a connection has seen its usual message size it stops allocating.
+class arena
+{
+public:
+    constexpr static const size_t blockSize = 4 * 1024;
+    // A reset never keeps more than this, one huge message doesn't pin memory
+    constexpr static const size_t maxRetained = 64 * 1024;
+    arena() = default;
+    arena(const arena &) = delete;
+    arena &operator=(const arena &) = delete;
+    ~arena();
+    void *allocate(size_t size, size_t alignment);
+    void reset();
+    size_t used() const;
+private:
+    struct block
+    {
+        block *next;
+        size_t size; // usable bytes after the header
+    };
+    block *newBlock(size_t size);
+    void release();
+    block *blocks = nullptr; // current block first
+    size_t offset = 0; // into the current block
+    size_t total = 0; // bytes in all blocks
+};
+
+// Lets standard containers and allocate_shared() take memory from an arena.
+// Without one it falls back to the global heap.
+template<typename T>
+struct arena_allocator
+{
+    typedef T value_type;
+    arena_allocator(arena *memory = nullptr)
+        : memory(memory){}
+    template<typename U>
+    arena_allocator(const arena_allocator<U> &other)
+        : memory(other.memory){}
+    T *allocate(size_t n)
+    {
+        if (memory) return static_cast<T *>(memory->allocate(n * sizeof(T), alignof(T)));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+    void deallocate(T *p, size_t)
+    {
+        if (!memory) ::operator delete(p);
+    }
+    template<typename U>
+    struct rebind
+    {
+        typedef arena_allocator<U> other;
+    };
+    arena *memory;
+};
+template<typename T, typename U>
+bool operator==(const arena_allocator<T> &a, const arena_allocator<U> &b)
+{ return a.memory == b.memory; }
+template<typename T, typename U>
+bool operator!=(const arena_allocator<T> &a, const arena_allocator<U> &b)
+{ return a.memory != b.memory; }
+
+
+#endif //POLL_EVENT_ARENA_H
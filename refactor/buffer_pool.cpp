@@ -0,0 +1,73 @@
+#include "buffer_pool.h"
+
+constexpr const size_t buffer_pool::bufferSize;
+constexpr const size_t buffer_pool::smallSize;
+
+buffer_pool::storage::~storage()
+{
+    for (char *buffer : idle) delete[] buffer;
+    for (char *buffer : idleSmall) delete[] buffer;
+    for (void *block : blocks) ::operator delete(block);
+}
+void *buffer_pool::storage::takeBlock(size_t size)
+{
+    if (size == blockSize && !blocks.empty()) {
+        void *block = blocks.back();
+        blocks.pop_back();
+        return block;
+    }
+    blockSize = size; // only ever one size, of the control block acquire() makes
+    return ::operator new(size);
+}
+void buffer_pool::storage::giveBlock(void *block, size_t size)
+{
+    if (size == blockSize && blocks.size() < maxIdle) {
+        blocks.push_back(block);
+    }
+    else {
+        ::operator delete(block);
+    }
+}
+void buffer_pool::recycler::operator()(char *buffer) const
+{
+    std::vector<char *> &idle = small ? home->idleSmall : home->idle;
+    if (idle.size() < home->maxIdle) {
+        idle.push_back(buffer);
+    }
+    else {
+        delete[] buffer;
+    }
+}
+buffer_pool::buffer_pool(size_t maxIdle)
+    : buffers(std::make_shared<storage>())
+{
+    buffers->maxIdle = maxIdle;
+}
+std::shared_ptr<char> buffer_pool::acquire()
+{
+    char *buffer;
+    if (buffers->idle.empty()) {
+        buffer = new char[bufferSize];
+    }
+    else {
+        buffer = buffers->idle.back();
+        buffers->idle.pop_back();
+    }
+    return std::shared_ptr<char>(buffer, recycler{buffers, false}, block_allocator<char>(buffers));
+}
+std::shared_ptr<char> buffer_pool::acquireSmall()
+{
+    char *buffer;
+    if (buffers->idleSmall.empty()) {
+        buffer = new char[smallSize];
+    }
+    else {
+        buffer = buffers->idleSmall.back();
+        buffers->idleSmall.pop_back();
+    }
+    return std::shared_ptr<char>(buffer, recycler{buffers, true}, block_allocator<char>(buffers));
+}
+size_t buffer_pool::idle() const
+{
+    return buffers->idle.size();
+}
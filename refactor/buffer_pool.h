@@ -0,0 +1,67 @@
+#ifndef POLL_EVENT_BUFFER_POOL_H
+#define POLL_EVENT_BUFFER_POOL_H
+
+#include <memory>
+#include <vector>
+
+// Fixed-size read buffers recycled within one reactor. A buffer goes back to
+// the pool when its last reference is dropped, so one read straight from a
+// socket can be queued for writing without a copy. The shared_ptr control
+// blocks are recycled as well: a warm pool hands out buffers without allocating.
+// Small buffers hold short reads copied out of a full one while they are queued.
+class buffer_pool
+{
+public:
+    constexpr static const size_t bufferSize = 16 * 1024;
+    constexpr static const size_t smallSize = bufferSize / 8;
+    buffer_pool(size_t maxIdle);
+    buffer_pool(const buffer_pool &) = delete;
+    buffer_pool &operator=(const buffer_pool &) = delete;
+    std::shared_ptr<char> acquire();
+    std::shared_ptr<char> acquireSmall(); // of smallSize
+    size_t idle() const;
+private:
+    // outlives the pool while buffers are still referenced
+    struct storage
+    {
+        ~storage();
+        void *takeBlock(size_t size);
+        void giveBlock(void *, size_t size);
+        std::vector<char *> idle;
+        std::vector<char *> idleSmall;
+        std::vector<void *> blocks; // control blocks, all of blockSize
+        size_t blockSize = 0;
+        size_t maxIdle;
+    };
+    struct recycler
+    {
+        std::shared_ptr<storage> home;
+        bool small;
+        void operator()(char *) const;
+    };
+    // Keeps the storage too: the control block is freed after its deleter is gone
+    template<typename T>
+    struct block_allocator
+    {
+        typedef T value_type;
+        block_allocator(std::shared_ptr<storage> home)
+            : home(std::move(home)){}
+        template<typename U>
+        block_allocator(const block_allocator<U> &other)
+            : home(other.home){}
+        T *allocate(size_t n)
+        { return static_cast<T *>(home->takeBlock(n * sizeof(T))); }
+        void deallocate(T *p, size_t n)
+        { home->giveBlock(p, n * sizeof(T)); }
+        template<typename U>
+        struct rebind
+        {
+            typedef block_allocator<U> other;
+        };
+        std::shared_ptr<storage> home;
+    };
+    std::shared_ptr<storage> buffers;
+};
+
+
+#endif //POLL_EVENT_BUFFER_POOL_H
@@ -0,0 +1,100 @@
+#include <algorithm>
+#include "chunked_decoder.h"
+
+namespace
+{
+    int hex_value(char c)
+    {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+}
+
+size_t chunked_decoder::feed(const char *data, size_t length)
+{
+    size_t i = 0;
+    while (i < length && state != DONE && state != FAIL) {
+        char c = data[i];
+        switch (state) {
+        case SIZE: {
+            int digit = hex_value(c);
+            if (digit >= 0) {
+                if (remaining >> 60) { // would overflow
+                    state = FAIL;
+                    break;
+                }
+                remaining = remaining * 16 + digit;
+                digits = true;
+            }
+            else if (!digits) {
+                state = FAIL;
+            }
+            else if (c == '\r') {
+                state = SIZE_LF;
+            }
+            else if (c == ';' || c == ' ' || c == '\t') {
+                state = EXTENSION;
+            }
+            else {
+                state = FAIL;
+            }
+            i++;
+            break;
+        }
+        case EXTENSION:
+            if (c == '\r') state = SIZE_LF;
+            else if (c == '\n') state = FAIL;
+            i++;
+            break;
+        case SIZE_LF:
+            if (c != '\n') {
+                state = FAIL;
+                break;
+            }
+            state = remaining == 0 ? TRAILER_START : DATA;
+            i++;
+            break;
+        case DATA: {
+            size_t take = static_cast<size_t>(std::min<uint64_t>(remaining, length - i));
+            remaining -= take;
+            i += take;
+            if (remaining == 0) state = DATA_CR;
+            break;
+        }
+        case DATA_CR:
+            state = c == '\r' ? DATA_LF : FAIL;
+            i++;
+            break;
+        case DATA_LF:
+            if (c != '\n') {
+                state = FAIL;
+                break;
+            }
+            state = SIZE;
+            digits = false;
+            i++;
+            break;
+        case TRAILER_START:
+            state = c == '\r' ? END_LF : TRAILER;
+            i++;
+            break;
+        case TRAILER:
+            if (c == '\r') state = TRAILER_LF;
+            i++;
+            break;
+        case TRAILER_LF:
+            state = c == '\n' ? TRAILER_START : FAIL;
+            i++;
+            break;
+        case END_LF:
+            state = c == '\n' ? DONE : FAIL;
+            i++;
+            break;
+        default:
+            break;
+        }
+    }
+    return i;
+}
@@ -0,0 +1,33 @@
+#ifndef POLL_EVENT_CHUNKED_DECODER_H
+#define POLL_EVENT_CHUNKED_DECODER_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Frames a chunked body (RFC 7230 4.1) as it arrives: chunk sizes,
+// extensions, and the trailer after the last chunk. Chunk data is skipped
+// by count, never scanned, and nothing is buffered, so the body can be
+// passed on while it is being framed.
+class chunked_decoder
+{
+public:
+    // Takes bytes that follow the ones fed before and returns how many
+    // belong to the body: all of them, unless the body ends inside
+    size_t feed(const char *data, size_t length);
+    bool done() const
+    { return state == DONE; }
+    bool failed() const
+    { return state == FAIL; }
+private:
+    enum state_t
+    {
+        SIZE, EXTENSION, SIZE_LF, DATA, DATA_CR, DATA_LF,
+        TRAILER_START, TRAILER, TRAILER_LF, END_LF, DONE, FAIL
+    };
+    state_t state = SIZE;
+    uint64_t remaining = 0; // of the chunk size while in SIZE, of its data in DATA
+    bool digits = false;
+};
+
+
+#endif //POLL_EVENT_CHUNKED_DECODER_H
@@ -0,0 +1,121 @@
+#ifndef POLL_EVENT_CONCURRENT_CACHE_H
+#define POLL_EVENT_CONCURRENT_CACHE_H
+
+#include <stddef.h>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <boost/optional/optional.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/shared_mutex.hpp>
+namespace cache
+{
+
+// A bounded cache safe to share between threads. Keys are hashed to shards,
+// each with its own reader-writer lock. Eviction is CLOCK, an approximation
+// of LRU: a hit only sets the slot's reference bit, so lookups take the
+// shard lock shared and never reorder anything.
+template<typename key_t, typename value_t, typename hash_t = std::hash<key_t>>
+class concurrent_cache
+{
+public:
+    concurrent_cache(size_t max_size, size_t shard_count = 16)
+    {
+        size_t count = 1;
+        while (count < shard_count) count <<= 1;
+        size_t capacity = (max_size + count - 1) / count;
+        if (capacity == 0) capacity = 1;
+        for (size_t i = 0; i < count; i++) _shards.emplace_back(new shard(capacity));
+    }
+    concurrent_cache(const concurrent_cache &) = delete;
+    concurrent_cache &operator=(const concurrent_cache &) = delete;
+
+    boost::optional<value_t> find(const key_t &key) const
+    {
+        const shard &s = shard_for(key);
+        boost::shared_lock<boost::shared_mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it == s.index.end()) return boost::none;
+        const slot &found = s.slots[it->second];
+        // readers race only on this bit, and avoid dirtying the line if it is set
+        if (!found.referenced.load(std::memory_order_relaxed)) {
+            found.referenced.store(true, std::memory_order_relaxed);
+        }
+        return found.item->second;
+    }
+    void put(const key_t &key, const value_t &value)
+    {
+        shard &s = shard_for(key);
+        boost::unique_lock<boost::shared_mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it != s.index.end()) {
+            s.slots[it->second].item->second = value;
+            s.slots[it->second].referenced.store(true, std::memory_order_relaxed);
+            return;
+        }
+        size_t victim;
+        if (s.used < s.capacity) {
+            victim = s.used++;
+        }
+        else {
+            // second chance: skip and clear referenced slots until one isn't
+            while (s.slots[s.hand].item // a slot freed by remove() is taken at once
+                   && s.slots[s.hand].referenced.exchange(false, std::memory_order_relaxed)) {
+                s.hand = (s.hand + 1) % s.capacity;
+            }
+            victim = s.hand;
+            s.hand = (s.hand + 1) % s.capacity;
+            if (s.slots[victim].item) s.index.erase(s.slots[victim].item->first);
+        }
+        s.slots[victim].item = std::make_pair(key, value);
+        s.slots[victim].referenced.store(false, std::memory_order_relaxed);
+        s.index[key] = victim;
+    }
+    void remove(const key_t &key)
+    {
+        shard &s = shard_for(key);
+        boost::unique_lock<boost::shared_mutex> lock(s.mutex);
+        auto it = s.index.find(key);
+        if (it == s.index.end()) return;
+        s.slots[it->second].item = boost::none;
+        s.index.erase(it);
+    }
+    size_t size() const
+    {
+        size_t total = 0;
+        for (auto &s : _shards) {
+            boost::shared_lock<boost::shared_mutex> lock(s->mutex);
+            total += s->index.size();
+        }
+        return total;
+    }
+
+private:
+    struct slot
+    {
+        boost::optional<std::pair<key_t, value_t>> item;
+        mutable std::atomic<bool> referenced{false};
+    };
+    struct shard
+    {
+        shard(size_t capacity)
+            : capacity(capacity), slots(new slot[capacity]){}
+        mutable boost::shared_mutex mutex;
+        size_t capacity;
+        size_t used = 0; // slots ever filled, the clock only runs once all are
+        size_t hand = 0;
+        std::unique_ptr<slot[]> slots;
+        std::unordered_map<key_t, size_t, hash_t> index;
+    };
+    shard &shard_for(const key_t &key) const
+    {
+        // the low bits usually pick the bucket inside the shard's map
+        size_t h = hash_t()(key);
+        return *_shards[(h >> 16 ^ h) & (_shards.size() - 1)];
+    }
+    std::vector<std::unique_ptr<shard>> _shards;
+};
+}
+
+#endif //POLL_EVENT_CONCURRENT_CACHE_H
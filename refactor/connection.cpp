@@ -9,18 +9,28 @@
 #include "posix_sockets.h"
 #include "debug.h"
 connection::connection(int _fd, io::io_service &ep, std::function<void()> end)
-    : fd(_fd), on_disconnect(std::move(end)), destroyed(nullptr),
+    : fd(_fd), destroyed(nullptr), on_disconnect(std::move(end)),
     // TODO: fd can leak if make_shared fails. DONE (fd now RAII class)
       ioEntry(ep, fd, errFlags, [this](uint32_t events)
       {
           bool is_destroyed = false;
           destroyed = &is_destroyed;
           try {
-              if (events & EPOLLIN) {
+              // A half-closed peer may still have unread bytes queued: while somebody
+              // reads, EPOLLRDHUP is left to surface as EOF from read().
+              bool reading = static_cast<bool>(on_read);
+              if ((events & (EPOLLIN | EPOLLRDHUP)) && reading) {
                   on_read();
                   if (is_destroyed) return;
               }
-              if (events & errFlags) {
+              bool hangup = (events & EPOLLRDHUP) && !reading;
+              if (hangup && get_available_bytes() != 0) {
+                  // reads are paused with bytes still queued: they go first, EOF after them
+                  hangupDeferred = true;
+                  syncIO();
+                  hangup = false;
+              }
+              if ((events & (EPOLLERR | EPOLLHUP)) || hangup) {
                   on_disconnect();
                   if (is_destroyed) return;
               }
@@ -41,20 +51,37 @@ connection::connection(int _fd, io::io_service &ep, std::function<void()> end)
 }
 void connection::syncIO()
 {
-    uint32_t flags = EPOLLERR | EPOLLHUP | EPOLLRDHUP;
-    if (on_read) flags |= EPOLLIN;
+    uint32_t flags = EPOLLERR | EPOLLHUP;
+    if (on_read) hangupDeferred = false; // reads reach the EOF themselves
+    if (on_read) flags |= EPOLLIN | EPOLLRDHUP;
+    else if (!hangupDeferred && !peerClosed) flags |= EPOLLRDHUP; // an idle peer closing is noticed
     if (on_write) flags |= EPOLLOUT;
 
     this->ioEntry.modify(flags);
 }
 ssize_t connection::read_over_connection(void *data, size_t size)
 {
-    return read_some(fd, data, size);
+    ssize_t res = read_some(fd, data, size);
+    if (res == 0) peer_closed();
+    return res;
+}
+void connection::peer_closed()
+{
+    peerClosed = true;
+    syncIO();
 }
 size_t connection::write_over_connection(void const *data, size_t size)
 {
     return write_some(fd, data, size);
 }
+size_t connection::writev_over_connection(const struct iovec *iov, int count)
+{
+    return writev_some(fd, iov, count);
+}
+void connection::shutdown_write()
+{
+    ::shutdown_write(fd);
+}
 connection connection::connect(io::io_service &ep, ipv4_endpoint const &remote, connection::callback on_disconnect)
 {
     int fd = make_socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK);
@@ -77,6 +104,12 @@ size_t connection::get_available_bytes() const
     }
     return static_cast<size_t>(n);
 }
+bool connection::is_open() const
+{
+    char probe;
+    ssize_t res = recv(fd.get_raw(), &probe, sizeof(probe), MSG_PEEK | MSG_DONTWAIT);
+    return res == -1 && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
 const handle &connection::getFd() const
 {
     return fd;
@@ -91,6 +124,10 @@ void connection::setOn_read(const callback &_on_read)
     on_read = _on_read;
     syncIO();
 }
+void connection::setOn_disconnect(const callback &_on_disconnect)
+{
+    on_disconnect = _on_disconnect;
+}
 connection::~connection()
 {
     if (destroyed) *destroyed = true;
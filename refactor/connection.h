@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 #include <sys/epoll.h>
+#include <sys/uio.h>
 #include <memory>
 #include "io_service.h"
 #include "address.h"
@@ -24,12 +25,17 @@ public:
     void setOn_read(const callback &_on_read);
     void setOn_write(const callback &_on_write);
     void setOn_rw(const callback &_on_read, const callback &on_write);
+    void setOn_disconnect(const callback &_on_disconnect);
     void sleep();
     const handle& getFd() const;
     ~connection();
     ssize_t read_over_connection(void *data, size_t size);
     size_t write_over_connection(void const *data, size_t size);
+    size_t writev_over_connection(const struct iovec *iov, int count);
+    void shutdown_write(); // sends FIN, reads go on
+    void peer_closed(); // its FIN was read: no more hangup events while reads are off
     size_t get_available_bytes() const;
+    bool is_open() const;
     static connection connect(io::io_service& ep, ipv4_endpoint const& remote, callback on_disconnect);
     void forceDisconnect();
 protected:
@@ -39,6 +45,8 @@ protected:
     callback on_read;
     callback on_write;
     callback on_disconnect;
+    bool hangupDeferred = false; // peer closed with unread bytes, seen again once reads resume
+    bool peerClosed = false;
     // TODO: check if shared_ptrs are neccessary. DONE
     io::io_entry ioEntry;
 
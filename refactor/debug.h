@@ -8,8 +8,9 @@
 
 #else
 
-#define LOG(...)
-#define INFO(...)
+// compiled out, but the arguments still count as used and get checked
+#define LOG(format, ...) do { if (false) fprintf(stderr, format "\n", __VA_ARGS__); } while (false)
+#define INFO(format) do { } while (false)
 
 #endif
 #endif
\ No newline at end of file
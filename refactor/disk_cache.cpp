@@ -0,0 +1,245 @@
+#include <algorithm>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "disk_cache.h"
+#include "handle.h"
+#include "epoll_error.h"
+#include "debug.h"
+
+namespace
+{
+    const uint64_t SLAB_MAGIC = 0x42414c5359585250ULL; // "PRXYSLAB"
+    const uint32_t RECORD_MAGIC = 0x43455250; // "PREC"
+    const uint32_t TOMBSTONE_MAGIC = 0x424d4f54; // "TOMB", the key only: older records of it are gone
+    struct slab_header
+    {
+        uint64_t magic;
+        uint64_t generation;
+    };
+    // Written after the record it describes, so a torn write leaves no magic
+    struct record_header
+    {
+        uint32_t magic;
+        uint32_t checksum; // FNV-1a of the text, checked on the first hit
+        uint32_t keyLength;
+        uint32_t etagLength;
+        uint64_t textLength;
+    };
+    size_t align(size_t n)
+    {
+        return (n + 7) & ~size_t(7);
+    }
+    uint32_t fnv1a(const char *data, size_t length)
+    {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < length; i++) {
+            hash ^= static_cast<unsigned char>(data[i]);
+            hash *= 16777619u;
+        }
+        return hash;
+    }
+}
+
+disk_cache::slab::~slab()
+{
+    if (base) munmap(base, capacity);
+}
+disk_cache::disk_cache(const std::string &directory, size_t slabSize, size_t slabCount)
+    : directory(directory), slabSize(slabSize), slabCount(std::max<size_t>(slabCount, 2))
+{
+    if (mkdir(directory.c_str(), 0755) == -1 && errno != EEXIST) {
+        throw_error(errno, "mkdir(disk cache)");
+    }
+    load();
+}
+void disk_cache::load()
+{
+    DIR *dir = opendir(directory.c_str());
+    if (!dir) throw_error(errno, "opendir(disk cache)");
+    std::vector<uint64_t> generations;
+    while (dirent *entry = readdir(dir)) {
+        char *end;
+        uint64_t generation = strtoull(entry->d_name, &end, 10);
+        if (end != entry->d_name && strcmp(end, ".slab") == 0) generations.push_back(generation);
+    }
+    closedir(dir);
+    std::sort(generations.begin(), generations.end());
+
+    for (uint64_t generation : generations) {
+        std::string path = directory + "/" + std::to_string(generation) + ".slab";
+        nextGeneration = std::max(nextGeneration, generation + 1);
+        handle fd(open(path.c_str(), O_RDONLY | O_CLOEXEC));
+        struct stat st;
+        if (fd.get_raw() == -1 || fstat(fd.get_raw(), &st) == -1
+            || static_cast<size_t>(st.st_size) < sizeof(slab_header)) {
+            LOG("Dropping unreadable slab %s", path.c_str());
+            unlink(path.c_str());
+            continue;
+        }
+        void *base = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd.get_raw(), 0);
+        if (base == MAP_FAILED) {
+            LOG("Couldn't map slab %s: %d", path.c_str(), errno);
+            continue;
+        }
+        std::shared_ptr<slab> s = std::make_shared<slab>();
+        s->path = path;
+        s->generation = generation;
+        s->base = static_cast<char *>(base);
+        s->capacity = st.st_size;
+        slab_header header;
+        memcpy(&header, s->base, sizeof(header));
+        if (header.magic != SLAB_MAGIC || header.generation != generation) {
+            LOG("Dropping foreign slab %s", path.c_str());
+            unlink(path.c_str());
+            continue;
+        }
+        scan(s);
+        s->used = s->capacity; // sealed: new records always go to a fresh slab
+        slabs.push_back(s);
+    }
+    while (slabs.size() >= slabCount) dropOldest();
+    LOG("Disk cache: %lu objects in %lu slabs", index.size(), slabs.size());
+}
+void disk_cache::scan(const std::shared_ptr<slab> &s)
+{
+    size_t offset = sizeof(slab_header);
+    while (offset + sizeof(record_header) <= s->capacity) {
+        record_header header;
+        memcpy(&header, s->base + offset, sizeof(header));
+        if (header.magic != RECORD_MAGIC && header.magic != TOMBSTONE_MAGIC) break;
+        size_t end = offset + sizeof(header) + header.keyLength + header.etagLength;
+        if (end > s->capacity || header.textLength > s->capacity - end) break;
+        end = align(end + header.textLength);
+        std::string key(s->base + offset + sizeof(header), header.keyLength);
+        // slabs are scanned oldest first, so the last word on a key wins
+        if (header.magic == TOMBSTONE_MAGIC) {
+            index.erase(key);
+        }
+        else {
+            index[key] = location{s, offset, false};
+            s->keys.push_back(std::move(key));
+        }
+        offset = end;
+    }
+}
+bool disk_cache::startSlab()
+{
+    while (slabs.size() >= slabCount) dropOldest();
+    uint64_t generation = nextGeneration++;
+    std::string path = directory + "/" + std::to_string(generation) + ".slab";
+    handle fd(open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644));
+    if (fd.get_raw() == -1) {
+        LOG("Couldn't create slab %s: %d", path.c_str(), errno);
+        return false;
+    }
+    // reserve the blocks now: running out of space under a mapping is SIGBUS
+    int err = posix_fallocate(fd.get_raw(), 0, slabSize);
+    if (err != 0) {
+        LOG("Couldn't allocate slab %s: %d", path.c_str(), err);
+        unlink(path.c_str());
+        return false;
+    }
+    void *base = mmap(nullptr, slabSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd.get_raw(), 0);
+    if (base == MAP_FAILED) {
+        LOG("Couldn't map slab %s: %d", path.c_str(), errno);
+        unlink(path.c_str());
+        return false;
+    }
+    std::shared_ptr<slab> s = std::make_shared<slab>();
+    s->path = path;
+    s->generation = generation;
+    s->base = static_cast<char *>(base);
+    s->capacity = slabSize;
+    s->used = sizeof(slab_header);
+    slab_header header{SLAB_MAGIC, generation};
+    memcpy(s->base, &header, sizeof(header));
+    slabs.push_back(s);
+    return true;
+}
+void disk_cache::dropOldest()
+{
+    std::shared_ptr<slab> s = slabs.front();
+    slabs.pop_front();
+    for (auto &key : s->keys) {
+        auto it = index.find(key);
+        if (it != index.end() && it->second.where == s) index.erase(it);
+    }
+    // hits in flight keep the mapping, and with it the unlinked file
+    unlink(s->path.c_str());
+    LOG("Dropped slab %s", s->path.c_str());
+}
+bool disk_cache::append(uint32_t magic, const std::string &key, const std::string &etag, const char *text,
+                        size_t length, size_t *offset)
+{
+    size_t need = align(sizeof(record_header) + key.size() + etag.size() + length);
+    if (need > max_object()) return false;
+    if (slabs.empty() || slabs.back()->capacity - slabs.back()->used < need) {
+        if (!startSlab()) return false;
+    }
+    std::shared_ptr<slab> s = slabs.back();
+    char *p = s->base + s->used + sizeof(record_header);
+    memcpy(p, key.data(), key.size());
+    memcpy(p + key.size(), etag.data(), etag.size());
+    memcpy(p + key.size() + etag.size(), text, length);
+    record_header header{magic, fnv1a(text, length), static_cast<uint32_t>(key.size()),
+                         static_cast<uint32_t>(etag.size()), length};
+    memcpy(s->base + s->used, &header, sizeof(header));
+    *offset = s->used;
+    s->used += need;
+    return true;
+}
+bool disk_cache::put(const std::string &key, const std::string &etag, const char *text, size_t length)
+{
+    size_t offset;
+    if (!append(RECORD_MAGIC, key, etag, text, length, &offset)) return false;
+    std::shared_ptr<slab> s = slabs.back();
+    index[key] = location{s, offset, true};
+    s->keys.push_back(key);
+    return true;
+}
+boost::optional<disk_cache::hit> disk_cache::find(const std::string &key)
+{
+    auto it = index.find(key);
+    if (it == index.end()) return boost::none;
+    location &loc = it->second;
+    record_header header;
+    memcpy(&header, loc.where->base + loc.offset, sizeof(header));
+    const char *etag = loc.where->base + loc.offset + sizeof(header) + header.keyLength;
+    const char *text = etag + header.etagLength;
+    if (!loc.verified) {
+        if (fnv1a(text, header.textLength) != header.checksum) {
+            LOG("Corrupted disk cache record: %s", key.c_str());
+            index.erase(it);
+            return boost::none;
+        }
+        loc.verified = true;
+    }
+    return hit{outstring(loc.where, text, header.textLength), std::string(etag, header.etagLength)};
+}
+// Records can't be taken back from a slab, a tombstone hides them from the next scan()
+void disk_cache::remove(const std::string &key)
+{
+    if (index.erase(key) == 0) return;
+    size_t offset;
+    if (!append(TOMBSTONE_MAGIC, key, std::string(), nullptr, 0, &offset)) {
+        LOG("Couldn't write a tombstone for %s", key.c_str());
+    }
+}
+size_t disk_cache::size() const
+{
+    return index.size();
+}
+size_t disk_cache::bytes() const
+{
+    size_t total = 0;
+    for (auto &s : slabs) total += s->used;
+    return total;
+}
+size_t disk_cache::max_object() const
+{
+    return slabSize - sizeof(slab_header);
+}
@@ -0,0 +1,69 @@
+#ifndef POLL_EVENT_DISK_CACHE_H
+#define POLL_EVENT_DISK_CACHE_H
+
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <boost/optional.hpp>
+#include "outstring.h"
+
+// Second cache tier: responses appended to memory-mapped slab files in a
+// directory. Each slab is written once, front to back, and the oldest one is
+// deleted when the tier is full, so eviction is FIFO by slab. Records carry
+// their own small header, so the index is rebuilt on startup by hopping from
+// header to header without touching the bodies; removals are written as
+// tombstones so a restart doesn't bring them back. Hits are served straight
+// from the mapping; a mapping lives until the last send from it completes.
+class disk_cache
+{
+public:
+    struct hit
+    {
+        outstring text;
+        std::string etag;
+    };
+    disk_cache(const std::string &directory, size_t slabSize, size_t slabCount);
+    disk_cache(const disk_cache &) = delete;
+    disk_cache &operator=(const disk_cache &) = delete;
+    bool put(const std::string &key, const std::string &etag, const char *text, size_t length);
+    boost::optional<hit> find(const std::string &key);
+    void remove(const std::string &key);
+    size_t size() const;
+    size_t bytes() const;
+    size_t max_object() const;
+private:
+    struct slab
+    {
+        ~slab();
+        std::string path;
+        uint64_t generation;
+        char *base = nullptr;
+        size_t capacity;
+        size_t used;
+        std::vector<std::string> keys; // indexed records, possibly superseded
+    };
+    struct location
+    {
+        std::shared_ptr<slab> where;
+        size_t offset; // of the record header
+        bool verified;
+    };
+    void load();
+    void scan(const std::shared_ptr<slab> &);
+    bool append(uint32_t magic, const std::string &key, const std::string &etag, const char *text, size_t length,
+                size_t *offset);
+    bool startSlab();
+    void dropOldest();
+    std::string directory;
+    size_t slabSize;
+    size_t slabCount;
+    uint64_t nextGeneration = 1;
+    std::deque<std::shared_ptr<slab>> slabs; // oldest first, the last one is written
+    std::unordered_map<std::string, location> index;
+};
+
+
+#endif //POLL_EVENT_DISK_CACHE_H
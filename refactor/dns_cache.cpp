@@ -0,0 +1,40 @@
+#include <algorithm>
+#include "dns_cache.h"
+#include "debug.h"
+
+constexpr const size_t dns_cache::defaultSize;
+constexpr const uint32_t dns_cache::maxTTL;
+constexpr const uint32_t dns_cache::maxNegativeTTL;
+constexpr const size_t dns_cache::popularHits;
+
+dns_cache::dns_cache(size_t maxEntries)
+    : entries(maxEntries)
+{
+
+}
+std::shared_ptr<const resolver::resolverNode> dns_cache::lookup(const std::string &host, clock_t::time_point now, bool &refresh)
+{
+    refresh = false;
+    auto found = entries.find(host);
+    if (!found) return nullptr;
+    std::shared_ptr<entry> e = found.get();
+    if (now >= e->expires) return nullptr; // replaced by the next store()
+    size_t hits = ++e->hits;
+    if (e->node.resolvedHost && hits >= popularHits && now >= e->refreshAt) {
+        refresh = !e->refreshing.exchange(true); // once per stored answer
+    }
+    return std::shared_ptr<const resolver::resolverNode>(e, &e->node);
+}
+void dns_cache::store(const resolver::resolverNode &node, clock_t::time_point now)
+{
+    uint32_t ttl = std::min(node.ttl, node.resolvedHost ? maxTTL : maxNegativeTTL);
+    if (ttl == 0) return; // keep serving a previous answer until it expires
+    auto lifetime = std::chrono::duration_cast<clock_t::duration>(std::chrono::seconds(ttl));
+    LOG("DNS cache: %s for %u s", node.host.c_str(), ttl);
+    // refresh in the last fifth of the lifetime
+    entries.put(node.host, std::make_shared<entry>(node, now + lifetime, now + lifetime - lifetime / 5));
+}
+size_t dns_cache::size() const
+{
+    return entries.size();
+}
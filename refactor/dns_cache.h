@@ -0,0 +1,48 @@
+#ifndef POLL_EVENT_DNS_CACHE_H
+#define POLL_EVENT_DNS_CACHE_H
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <boost/optional.hpp>
+#include "concurrent_cache.h"
+#include "resolver.h"
+#include "timer.h"
+
+// Resolved names with their record TTLs, consulted on the loop thread so a
+// hit never touches the resolver. Failures are kept only when they carry a
+// TTL (NXDOMAIN), and for a short time. Thread-safe: all reactors share one,
+// so a name resolved by any of them is a hit for the rest.
+class dns_cache
+{
+public:
+    typedef io::timer::timer_service::clock_t clock_t;
+    dns_cache(size_t maxEntries);
+    // A fresh answer, if any. Sets refresh for exactly one caller once a popular
+    // name is close to expiring, so it can be resolved again in the background.
+    // The answer is shared with the cache, not copied.
+    std::shared_ptr<const resolver::resolverNode> lookup(const std::string &host, clock_t::time_point now, bool &refresh);
+    void store(const resolver::resolverNode &, clock_t::time_point now);
+    size_t size() const;
+
+    constexpr static const size_t defaultSize = 10000;
+    constexpr static const uint32_t maxTTL = 3600;
+    constexpr static const uint32_t maxNegativeTTL = 30;
+    constexpr static const size_t popularHits = 3;
+private:
+    // immutable but for the counters, so readers copy only the pointer
+    struct entry
+    {
+        entry(const resolver::resolverNode &node, clock_t::time_point expires, clock_t::time_point refreshAt)
+            : node(node), expires(expires), refreshAt(refreshAt){}
+        const resolver::resolverNode node;
+        const clock_t::time_point expires;
+        const clock_t::time_point refreshAt;
+        std::atomic<size_t> hits{0};
+        std::atomic<bool> refreshing{false};
+    };
+    cache::concurrent_cache<std::string, std::shared_ptr<entry>> entries;
+};
+
+
+#endif //POLL_EVENT_DNS_CACHE_H
@@ -0,0 +1,245 @@
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <unistd.h>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include "dns_client.h"
+#include "posix_sockets.h"
+#include "epoll_error.h"
+#include "utils.h"
+#include "debug.h"
+
+constexpr const size_t dns_client::maxAttempts;
+constexpr const uint32_t dns_client::failureTTL;
+
+namespace
+{
+const uint16_t TYPE_A = 1;
+const uint16_t CLASS_IN = 1;
+const uint16_t RCODE_NXDOMAIN = 3;
+const size_t HEADER_SIZE = 12;
+const size_t MAX_PACKET = 4096;
+
+uint16_t read16(const unsigned char *p)
+{
+    return static_cast<uint16_t>((p[0] << 8) | p[1]);
+}
+uint32_t read32(const unsigned char *p)
+{
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16)
+        | (static_cast<uint32_t>(p[2]) << 8) | p[3];
+}
+// returns offset right after the (possibly compressed) name, 0 if malformed
+size_t skip_name(const unsigned char *packet, size_t size, size_t pos)
+{
+    while (pos < size) {
+        unsigned char len = packet[pos];
+        if (len == 0) return pos + 1;
+        if ((len & 0xC0) == 0xC0) return pos + 2 <= size ? pos + 2 : 0;
+        pos += len + 1;
+    }
+    return 0;
+}
+bool encode_name(const std::string &name, std::string &out)
+{
+    if (name.empty() || name.size() > 253) return false;
+    size_t start = 0;
+    while (start <= name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) dot = name.size();
+        size_t len = dot - start;
+        if (len == 0 && dot != name.size()) return false;
+        if (len > 63) return false;
+        if (len) {
+            out.push_back(static_cast<char>(len));
+            out.append(name, start, len);
+        }
+        start = dot + 1;
+    }
+    out.push_back('\0');
+    return true;
+}
+}
+
+dns_client::dns_client(io::io_service &ios, ipv4_endpoint const &nameserver, callback on_answer)
+    : ios(&ios), nameserver(nameserver), on_answer(std::move(on_answer))
+{
+    LOG("Async DNS via %s", nameserver.to_string().c_str());
+}
+dns_client::~dns_client()
+{
+}
+void dns_client::resolve(const std::string &host)
+{
+    std::string name = host, port = "80";
+    auto colon = host.find(':');
+    if (colon != host.npos) {
+        port = host.substr(colon + 1);
+        name = host.substr(0, colon);
+    }
+    uint16_t portShort;
+    if (!str_to_uint16(port.c_str(), &portShort)) {
+        LOG("Invalid port(%s)", port.c_str());
+        on_answer({host, boost::none, failureTTL});
+        return;
+    }
+    in_addr literal;
+    if (inet_pton(AF_INET, name.c_str(), &literal) == 1) {
+        on_answer({host, ipv4_endpoint(portShort, ipv4_address(literal.s_addr)), UINT32_MAX});
+        return;
+    }
+    auto pending = byName.find(name);
+    if (pending != byName.end()) {
+        queries[pending->second]->hosts.push_back(host);
+        return;
+    }
+    std::unique_ptr<query> q(new query);
+    q->id = next_id();
+    q->name = name;
+    q->hosts.push_back(host);
+    q->fd.reset(make_socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC));
+    connect_socket(q->fd.get_raw(), nameserver.iport(), nameserver.addrnet());
+    query &ref = *q;
+    q->ioEntry.reset(new io::io_entry(*ios, q->fd, EPOLLIN, [this, &ref](uint32_t)
+    { onRead(ref); }));
+    byName.emplace(name, q->id);
+    queries.emplace(q->id, std::move(q));
+    send(ref);
+}
+uint16_t dns_client::next_id()
+{
+    // drawn from the system's entropy source: an id seen on the wire says nothing about the next
+    uint16_t id;
+    do {
+        id = static_cast<uint16_t>(random());
+    }
+    while (queries.count(id));
+    return id;
+}
+void dns_client::send(query &q)
+{
+    std::string packet;
+    packet.push_back(static_cast<char>(q.id >> 8));
+    packet.push_back(static_cast<char>(q.id & 0xFF));
+    packet.append("\x01\x00", 2); // RD
+    packet.append("\x00\x01\x00\x00\x00\x00\x00\x00", 8); // QDCOUNT = 1
+    if (!encode_name(q.name, packet)) {
+        LOG("Not a valid domain name: %s", q.name.c_str());
+        finish(q.id, boost::none, failureTTL);
+        return;
+    }
+    packet.append("\x00\x01\x00\x01", 4); // A, IN
+    if (::send(q.fd.get_raw(), packet.data(), packet.size(), 0) == -1) {
+        LOG("DNS send failed: %d. Will retry", errno);
+    }
+    uint16_t id = q.id;
+    q.timer = io::timer::timer_element(ios->getClock(), std::chrono::milliseconds(500 << q.attempts), [this, id]()
+    {
+        onTimeout(*queries[id]);
+    });
+    q.attempts++;
+}
+void dns_client::onTimeout(query &q)
+{
+    if (q.attempts >= maxAttempts) {
+        LOG("DNS timeout: %s", q.name.c_str());
+        finish(q.id, boost::none, 0); // not an answer, so nothing to cache
+        return;
+    }
+    send(q);
+}
+void dns_client::onRead(query &q)
+{
+    unsigned char packet[MAX_PACKET];
+    for (;;) {
+        ssize_t size = recv(q.fd.get_raw(), packet, sizeof(packet), 0);
+        if (size == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK) return;
+            if (errno == EINTR || errno == ECONNREFUSED) continue; // unreachable nameserver: retries decide
+            throw_error(errno, "recv(dns)");
+        }
+        if (static_cast<size_t>(size) < HEADER_SIZE) continue;
+        size_t n = static_cast<size_t>(size);
+        uint16_t id = read16(packet);
+        uint16_t flags = read16(packet + 2);
+        if (id != q.id || !(flags & 0x8000)) continue;
+
+        // the question must be the one we asked, or the packet is not ours
+        std::string question;
+        if (!encode_name(q.name, question) || n < HEADER_SIZE + question.size() + 4
+            || question.compare(0, question.size(), reinterpret_cast<char *>(packet + HEADER_SIZE), question.size()) != 0) {
+            continue;
+        }
+        size_t pos = HEADER_SIZE + question.size() + 4;
+        uint16_t answers = read16(packet + 6);
+        uint16_t rcode = flags & 0x000F;
+
+        boost::optional<ipv4_address> address;
+        uint32_t ttl = UINT32_MAX;
+        for (uint16_t i = 0; i < answers && rcode == 0; i++) {
+            pos = skip_name(packet, n, pos);
+            if (pos == 0 || pos + 10 > n) break;
+            uint16_t type = read16(packet + pos), cls = read16(packet + pos + 2);
+            uint32_t recordTTL = read32(packet + pos + 4);
+            uint16_t length = read16(packet + pos + 8);
+            pos += 10;
+            if (pos + length > n) break;
+            ttl = std::min(ttl, recordTTL); // a CNAME chain is only as fresh as its weakest link
+            if (type == TYPE_A && cls == CLASS_IN && length == 4) {
+                uint32_t addr_net;
+                memcpy(&addr_net, packet + pos, 4);
+                address = ipv4_address(addr_net);
+                break;
+            }
+            pos += length;
+        }
+        if (!address) {
+            LOG("DNS failure for %s (rcode %d)", q.name.c_str(), rcode);
+            ttl = rcode == RCODE_NXDOMAIN ? failureTTL : 0;
+        }
+        finish(id, address, ttl);
+        return; // the query and its socket are gone
+    }
+}
+void dns_client::finish(uint16_t id, boost::optional<ipv4_address> address, uint32_t ttl)
+{
+    auto it = queries.find(id);
+    std::unique_ptr<query> q = std::move(it->second);
+    queries.erase(it);
+    byName.erase(q->name);
+    for (auto &host : q->hosts) {
+        uint16_t port = 80;
+        auto colon = host.find(':');
+        if (colon != host.npos) str_to_uint16(host.c_str() + colon + 1, &port);
+        if (address) {
+            on_answer({host, ipv4_endpoint(port, address.get()), ttl});
+        }
+        else {
+            on_answer({host, boost::none, ttl});
+        }
+    }
+}
+size_t dns_client::inflight() const
+{
+    return queries.size();
+}
+ipv4_endpoint dns_client::system_nameserver()
+{
+    std::ifstream conf("/etc/resolv.conf");
+    std::string line;
+    while (std::getline(conf, line)) {
+        std::istringstream words(line);
+        std::string keyword, address;
+        words >> keyword >> address;
+        if (keyword != "nameserver") continue;
+        try {
+            return ipv4_endpoint(53, ipv4_address(address));
+        }
+        catch (std::exception &) {
+            // IPv6 nameserver, look further
+        }
+    }
+    return ipv4_endpoint(53, ipv4_address("127.0.0.1"));
+}
@@ -0,0 +1,60 @@
+#ifndef POLL_EVENT_DNS_CLIENT_H
+#define POLL_EVENT_DNS_CLIENT_H
+
+#include <string>
+#include <memory>
+#include <random>
+#include <unordered_map>
+#include <functional>
+#include <boost/optional.hpp>
+#include "io_service.h"
+#include "address.h"
+#include "handle.h"
+
+// Stub resolver running on the event loop: A queries retransmitted with
+// backoff from timer_service. Concurrent lookups of one name share a single
+// query. Every query has a random id and a UDP socket of its own, so its
+// source port is a fresh ephemeral one: an off-path forger has to guess both.
+class dns_client
+{
+public:
+    struct answer
+    {
+        std::string host; // "name[:port]" exactly as requested
+        boost::optional<ipv4_endpoint> resolved;
+        uint32_t ttl; // seconds
+    };
+    typedef std::function<void(const answer &)> callback;
+    dns_client(io::io_service &, ipv4_endpoint const &nameserver, callback);
+    ~dns_client();
+    void resolve(const std::string &host);
+    size_t inflight() const;
+    static ipv4_endpoint system_nameserver();
+private:
+    struct query
+    {
+        uint16_t id;
+        std::string name;
+        std::vector<std::string> hosts; // every "name:port" waiting for this name
+        size_t attempts = 0;
+        io::timer::timer_element timer;
+        handle fd; // connected to the nameserver
+        std::unique_ptr<io::io_entry> ioEntry;
+    };
+    constexpr static const size_t maxAttempts = 3;
+    constexpr static const uint32_t failureTTL = 5;
+    void send(query &);
+    void onRead(query &);
+    void onTimeout(query &);
+    void finish(uint16_t id, boost::optional<ipv4_address> address, uint32_t ttl);
+    uint16_t next_id();
+    io::io_service *ios;
+    ipv4_endpoint nameserver;
+    callback on_answer;
+    std::random_device random;
+    std::unordered_map<uint16_t, std::unique_ptr<query>> queries;
+    std::unordered_map<std::string, uint16_t> byName;
+};
+
+
+#endif //POLL_EVENT_DNS_CLIENT_H
@@ -0,0 +1,54 @@
+#ifndef POLL_EVENT_FIFO_H
+#define POLL_EVENT_FIFO_H
+
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+// A queue over one vector that keeps its capacity: once the queue settles
+// at its usual depth, pushing and popping allocate nothing, where a deque
+// frees and allocates a node every few hundred elements.
+template<typename T>
+class fifo
+{
+public:
+    typedef typename std::vector<T>::iterator iterator;
+    void push_back(T value)
+    {
+        if (head == items.size()) clear();
+        else if (head >= items.size() / 2 && items.size() == items.capacity()) compact(); // instead of growing
+        items.push_back(std::move(value));
+    }
+    T &front()
+    { return items[head]; }
+    // What it references is released now, not when the slot is reused
+    void pop_front()
+    {
+        T released(std::move(items[head]));
+        if (++head == items.size()) clear();
+    }
+    void clear()
+    {
+        items.clear();
+        head = 0;
+    }
+    bool empty() const
+    { return head == items.size(); }
+    size_t size() const
+    { return items.size() - head; }
+    iterator begin()
+    { return items.begin() + head; }
+    iterator end()
+    { return items.end(); }
+private:
+    void compact()
+    {
+        items.erase(items.begin(), items.begin() + head);
+        head = 0;
+    }
+    std::vector<T> items;
+    size_t head = 0;
+};
+
+
+#endif //POLL_EVENT_FIFO_H
@@ -26,6 +26,11 @@ void handle::close()
     }
     raw = -1;
 }
+void handle::reset(int fd)
+{
+    close();
+    raw = fd;
+}
 int handle::get_raw() const
 {
     return raw;
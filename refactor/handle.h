@@ -13,6 +13,7 @@ public:
     handle(int fd);
     ~handle();
     void close();
+    void reset(int fd);
     int get_raw() const;
 private:
     int raw = -1;
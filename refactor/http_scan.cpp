@@ -0,0 +1,106 @@
+#include <cstdint>
+#include <immintrin.h>
+#include "http_scan.h"
+
+namespace http_scan
+{
+const stop_set token{"\x00\x20\x7f\x7f", 4};
+const stop_set uri{"\x00\x20\x7f\x7f", 4};
+const stop_set name{"\x00\x20::\x7f\xff", 6};
+const stop_set value{"\x00\x08\x0a\x1f\x7f\x7f", 6};
+}
+
+namespace
+{
+typedef const char *(*scan_fn)(const char *, const char *, const http_scan::stop_set &);
+
+inline bool in_set(unsigned char c, const http_scan::stop_set &set)
+{
+    for (size_t i = 0; i + 1 < set.size; i += 2) {
+        if (c >= static_cast<unsigned char>(set.ranges[i]) && c <= static_cast<unsigned char>(set.ranges[i + 1]))
+            return true;
+    }
+    return false;
+}
+const char *scan_scalar(const char *p, const char *end, const http_scan::stop_set &set)
+{
+    for (; p != end; ++p) {
+        if (in_set(static_cast<unsigned char>(*p), set)) return p;
+    }
+    return end;
+}
+__attribute__((target("sse4.2")))
+const char *scan_sse42(const char *p, const char *end, const http_scan::stop_set &set)
+{
+    if (end - p < 16) return scan_scalar(p, end, set); // shorter than a vector, setting up costs more than it saves
+    char padded[16] = {};
+    for (size_t i = 0; i < set.size; i++) padded[i] = set.ranges[i];
+    __m128i ranges = _mm_loadu_si128(reinterpret_cast<const __m128i *>(padded));
+    for (; end - p >= 16; p += 16) {
+        __m128i data = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+        int idx = _mm_cmpestri(ranges, static_cast<int>(set.size), data, 16,
+                               _SIDD_UBYTE_OPS | _SIDD_CMP_RANGES | _SIDD_LEAST_SIGNIFICANT);
+        if (idx != 16) return p + idx;
+    }
+    return scan_scalar(p, end, set);
+}
+__attribute__((target("avx2")))
+const char *scan_avx2(const char *p, const char *end, const http_scan::stop_set &set)
+{
+    if (end - p < 32) return scan_sse42(p, end, set);
+    __m256i lo[8], hi[8];
+    size_t pairs = set.size / 2;
+    for (size_t i = 0; i < pairs; i++) {
+        lo[i] = _mm256_set1_epi8(set.ranges[2 * i]);
+        hi[i] = _mm256_set1_epi8(set.ranges[2 * i + 1]);
+    }
+    for (; end - p >= 32; p += 32) {
+        __m256i data = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(p));
+        __m256i hit = _mm256_setzero_si256();
+        for (size_t i = 0; i < pairs; i++) {
+            // unsigned lo <= data <= hi through max/min
+            __m256i above = _mm256_cmpeq_epi8(_mm256_max_epu8(data, lo[i]), data);
+            __m256i below = _mm256_cmpeq_epi8(_mm256_min_epu8(data, hi[i]), data);
+            hit = _mm256_or_si256(hit, _mm256_and_si256(above, below));
+        }
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(hit));
+        if (mask) return p + __builtin_ctz(mask);
+    }
+    return scan_sse42(p, end, set);
+}
+struct dispatch
+{
+    scan_fn fn;
+    const char *name;
+    dispatch()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            fn = scan_avx2;
+            name = "avx2";
+        }
+        else if (__builtin_cpu_supports("sse4.2")) {
+            fn = scan_sse42;
+            name = "sse4.2";
+        }
+        else {
+            fn = scan_scalar;
+            name = "scalar";
+        }
+    }
+};
+const dispatch &selected()
+{
+    static const dispatch d;
+    return d;
+}
+}
+
+const char *http_scan::find(const char *begin, const char *end, const stop_set &set)
+{
+    return selected().fn(begin, end, set);
+}
+const char *http_scan::implementation()
+{
+    return selected().name;
+}
@@ -0,0 +1,27 @@
+#ifndef POLL_EVENT_HTTP_SCAN_H
+#define POLL_EVENT_HTTP_SCAN_H
+
+#include <cstddef>
+
+namespace http_scan
+{
+// Stop sets are inclusive byte ranges given as pairs ("az09" is [a-z] or [0-9]),
+// at most 8 pairs. Every set includes the control bytes, so a scan never runs
+// past CR and an invalid byte always stops it.
+struct stop_set
+{
+    const char *ranges;
+    size_t size;
+};
+extern const stop_set token;   // method, version, status code: stops on SP and CTL
+extern const stop_set uri;     // request target: stops on SP, CTL and DEL
+extern const stop_set name;    // header field name: stops on ':', SP, CTL, DEL and non-ASCII
+extern const stop_set value;   // header value / reason phrase: stops on CTL except HTAB, and DEL
+
+// First byte in [begin, end) that falls into `set`, or end. Uses AVX2 or
+// SSE4.2 when the CPU has them, scalar code otherwise.
+const char *find(const char *begin, const char *end, const stop_set &set);
+const char *implementation();
+}
+
+#endif //POLL_EVENT_HTTP_SCAN_H
@@ -4,27 +4,28 @@
 
 #include <sys/epoll.h>
 #include <unistd.h>
+#include <cassert>
+#include <algorithm>
 #include "io_service.h"
 #include "debug.h"
 #include "epoll_error.h"
 
-io::io_service::io_service(size_t timeoutMS, std::function<int()> func)
-    : timeoutMS(timeoutMS), timeout(func)
+io::io_service::io_service(size_t timeoutMS, std::function<int()> func, size_t batchSize)
+    : timeout(func), timeoutMS(timeoutMS), batch(std::max<size_t>(batchSize, 1))
 {
-    epoll = epoll_create(MAX_EVENTS);
+    epoll = epoll_create(batch.size());
     INFO("IO_SERVICE created");
 }
 io::io_service::io_service()
-    : io_service(1000, nullptr)
+    : io_service(1000, nullptr, DEFAULT_BATCH)
 {
 
 }
 
 void io::io_service::default_timeout()
 {
-    static int i = 0;
-    i++;
-    if(i%10==0)LOG("Timeouted: %d times.",i);
+    timeouts++;
+    if(timeouts%10==0)LOG("Timeouted: %lu times.",timeouts);
 }
 
 void io::io_service::control(handle& fd, int operation, uint32_t flags, io_entry *to)
@@ -45,12 +46,11 @@ int io::io_service::run()
 
 int io::io_service::loop()
 {
-    epoll_event events[MAX_EVENTS];
     int count;
     int nearest_timer = calculate_timeout();
     timeoutMS = (nearest_timer<0)?(1000):(nearest_timer);
     do {
-        count = epoll_wait(epoll, events, MAX_EVENTS, timeoutMS);
+        count = epoll_wait(epoll, batch.data(), static_cast<int>(batch.size()), timeoutMS);
     }
     while (count < 0 && errno == EINTR);
     if(count < 0){
@@ -66,8 +66,10 @@ int io::io_service::loop()
             return 0;
         }
     }
-    for(int i=0;i<count;++i){
-        auto &ee = events[i];
+    harvested = static_cast<size_t>(count);
+    for(next=0;next<harvested;){
+        auto &ee = batch[next++];
+        if (!ee.data.ptr) continue; // entry destroyed by an earlier callback of this batch
         try {
             static_cast<io_entry *>(ee.data.ptr)->callback(ee.events);
         }
@@ -78,8 +80,20 @@ int io::io_service::loop()
             INFO("Something happened on EPOLL execution");
         }
     }
+    next = harvested = 0;
     return 0;
 }
+void io::io_service::forget(io_entry *entry)
+{
+    for (size_t i = next; i < harvested; ++i) {
+        if (batch[i].data.ptr == entry) batch[i].data.ptr = nullptr;
+    }
+}
+void io::io_service::setBatchSize(size_t size)
+{
+    assert(harvested == 0);
+    batch.resize(std::max<size_t>(size, 1));
+}
 
 void io::io_service::removefd(handle& i)
 {
@@ -98,7 +112,7 @@ void io::io_service::setHolder(void *holder)
 }
 
 io::io_entry::io_entry(io::io_service &service, handle& fd, uint32_t flags, std::function<void(uint32_t)> function)
-    : fd(fd), events(flags), parent(&service), callback(function)
+    : fd(fd), parent(&service), events(flags), callback(function)
 {
     service.control(this->fd, EPOLL_CTL_ADD, flags, this);
 }
@@ -120,7 +134,10 @@ void io::io_entry::sync()
 }
 io::io_entry::~io_entry()
 {
-    if(parent) parent->removefd(this->fd);
+    if(parent) {
+        parent->forget(this);
+        parent->removefd(this->fd);
+    }
 }
 void io::io_service::setCallback(std::function<int()> function)
 {
@@ -134,7 +151,12 @@ int io::io_service::calculate_timeout()
     clock.process(now);
     if(clock.empty()) return -1;
 
-    return std::chrono::duration_cast<std::chrono::milliseconds>(clock.top()-now).count();
+    // rounded up: a wait truncated to 0 ms would spin until the tick passes
+    auto exact = clock.top() - now;
+    if (exact <= exact.zero()) return 0;
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>(exact);
+    if (left < exact) ++left;
+    return static_cast<int>(left.count());
 }
 io::timer::timer_service &io::io_service::getClock()
 {
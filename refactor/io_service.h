@@ -7,12 +7,14 @@
 #include <unordered_map>
 #include <functional>
 #include <memory>
+#include <vector>
+#include <sys/epoll.h>
 #include "timer.h"
 #include "handle.h"
 
 class connection;
 class acceptor;
-#define MAX_EVENTS 1
+#define DEFAULT_BATCH 256
 namespace io
 {
 class io_entry;
@@ -22,15 +24,20 @@ class io_service
     void default_timeout();
     std::function<int()> timeout;
     size_t timeoutMS = 1000;
+    size_t timeouts = 0;
     int epoll;
     void *holder;
     timer::timer_service clock;
+    std::vector<epoll_event> batch;
+    size_t next = 0, harvested = 0; // batch[next..harvested) is not dispatched yet
     int calculate_timeout();
     int loop();
+    void forget(io_entry *);
 public:
     io_service();
-    io_service(size_t, std::function<int()> func = NULL);
+    io_service(size_t, std::function<int()> func = NULL, size_t batchSize = DEFAULT_BATCH);
     void setCallback(std::function<int()>);
+    void setBatchSize(size_t);
     void control(handle&, int, uint32_t, io_entry *);
     void removefd(handle&);
     int run();
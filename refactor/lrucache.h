@@ -6,13 +6,23 @@
 #define POLL_EVENT_LRUCACHE_H
 
 #include <stddef.h>
+#include <functional>
 #include <list>
 #include <unordered_map>
+#include <utility>
 #include <boost/optional/optional.hpp>
 namespace cache
 {
 
-template<typename key_t, typename value_t>
+// Every entry costs 1, so max_size is an entry count
+struct unit_cost
+{
+    template<typename key_t, typename value_t>
+    size_t operator()(const key_t &, const value_t &) const
+    { return 1; }
+};
+
+template<typename key_t, typename value_t, typename cost_t = unit_cost>
 class lru_cache
 {
 public:
@@ -25,27 +35,31 @@ public:
     void remove(const key_t &key){
         auto it = _cache_items_map.find(key);
         if (it != _cache_items_map.end()) {
+            _cost -= cost_t()(it->second->first, it->second->second);
             _cache_items_list.erase(it->second);
             _cache_items_map.erase(it);
         }
     }
     void put(const key_t &key, const value_t &value)
     {
-        auto it = _cache_items_map.find(key);
-        if (it != _cache_items_map.end()) {
-            _cache_items_list.erase(it->second);
-            _cache_items_map.erase(it);
-        }
+        remove(key);
+        size_t cost = cost_t()(key, value);
+        if (cost > _max_size) return; // would evict everything and still not fit
 
         _cache_items_list.push_front(key_value_pair_t(key, value));
         _cache_items_map[key] = _cache_items_list.begin();
-
-        if (_cache_items_map.size() > _max_size) {
-            auto last = _cache_items_list.end();
-            last--;
-            _cache_items_map.erase(last->first);
-            _cache_items_list.pop_back();
-        }
+        _cost += cost;
+        shrink();
+    }
+    // Called for entries pushed out by the budget, not for remove() or replacement
+    void set_on_evict(std::function<void(const key_t &, const value_t &)> callback)
+    {
+        _on_evict = std::move(callback);
+    }
+    void set_max_size(size_t max_size)
+    {
+        _max_size = max_size;
+        shrink();
     }
 
     const value_t &get(const key_t &key)
@@ -59,6 +73,14 @@ public:
             return it->second->second;
         }
     }
+    // Like get(), but returns nullptr for a missing key and allows updates in place
+    value_t *find(const key_t &key)
+    {
+        auto it = _cache_items_map.find(key);
+        if (it == _cache_items_map.end()) return nullptr;
+        _cache_items_list.splice(_cache_items_list.begin(), _cache_items_list, it->second);
+        return &it->second->second;
+    }
     bool exists(const key_t &key) const
     {
         return _cache_items_map.find(key) != _cache_items_map.end();
@@ -69,11 +91,37 @@ public:
 
         return _cache_items_map.size();
     }
+    // Sum of entry costs, equal to size() with unit_cost
+    size_t cost() const
+    { return _cost; }
+    size_t evictions() const
+    { return _evictions; }
 
 //private:
+    void shrink()
+    {
+        while (_cost > _max_size) {
+            // unlinked and accounted for first: the callback sees a consistent cache
+            key_value_pair_t last = std::move(_cache_items_list.back());
+            _cache_items_map.erase(last.first);
+            _cache_items_list.pop_back();
+            _cost -= cost_t()(last.first, last.second);
+            _evictions++;
+            if (!_on_evict) continue;
+            try {
+                _on_evict(last.first, last.second);
+            }
+            catch (...) {
+                // the entry is gone either way, a failed spill must not stop the others
+            }
+        }
+    }
     std::list<key_value_pair_t> _cache_items_list;
     std::unordered_map<key_t, decltype(_cache_items_list.begin())> _cache_items_map;
     size_t _max_size;
+    size_t _cost = 0;
+    size_t _evictions = 0;
+    std::function<void(const key_t &, const value_t &)> _on_evict;
 };
 }
 
@@ -3,17 +3,105 @@
 //
 
 #include <thread>
+#include <cstring>
+#include <cstdlib>
+#include <sys/stat.h>
 #include "io_service.h"
-#include "proxy_server.h"
-int main()
+#include "reactor.h"
+#include "signal_fd.h"
+#include "debug.h"
+#include "utils.h"
+#include "epoll_error.h"
+static ipv4_endpoint parse_endpoint(const std::string &text, uint16_t defaultPort)
 {
+    uint16_t port = defaultPort;
+    auto colon = text.find(':');
+    if (colon != text.npos && !str_to_uint16(text.c_str() + colon + 1, &port)) {
+        throw std::runtime_error("invalid port in " + text);
+    }
+    return ipv4_endpoint(port, ipv4_address(text.substr(0, colon)));
+}
+int main(int argc, char **argv)
+{
+    size_t reactors = 1;
+    size_t cacheMegabytes = 0;
+    size_t diskMegabytes = 0;
+    std::string diskDirectory;
+    reactor_options options;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--reactors") == 0 && i + 1 < argc) {
+            reactors = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            options.batch = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--resolvers") == 0 && i + 1 < argc) {
+            options.resolvers = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--nameserver") == 0 && i + 1 < argc) {
+            options.nameserver = parse_endpoint(argv[++i], 53);
+        }
+        else if (strcmp(argv[i], "--cache-mb") == 0 && i + 1 < argc) {
+            cacheMegabytes = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--disk-cache") == 0 && i + 1 < argc) {
+            diskDirectory = argv[++i];
+        }
+        else if (strcmp(argv[i], "--disk-mb") == 0 && i + 1 < argc) {
+            diskMegabytes = strtoul(argv[++i], nullptr, 10);
+        }
+        else if (strcmp(argv[i], "--low-water-kb") == 0 && i + 1 < argc) {
+            options.lowWatermark = strtoul(argv[++i], nullptr, 10) * 1024;
+        }
+        else if (strcmp(argv[i], "--high-water-kb") == 0 && i + 1 < argc) {
+            options.highWatermark = strtoul(argv[++i], nullptr, 10) * 1024;
+        }
+        else if (strcmp(argv[i], "--admin-port") == 0 && i + 1 < argc) {
+            uint16_t port;
+            if (!str_to_uint16(argv[++i], &port)) throw std::runtime_error("invalid --admin-port");
+            options.admin = ipv4_endpoint(port, ipv4_address("127.0.0.1")); // local only
+        }
+        else if (strcmp(argv[i], "--async-dns") == 0) {
+            options.nameserver = dns_client::system_nameserver();
+        }
+    }
+    if (reactors == 0) reactors = std::max(1u, std::thread::hardware_concurrency());
+    if (cacheMegabytes) options.cacheBudget = cacheMegabytes * 1024 * 1024 / reactors; // split between reactors
+
+    // Signals must be blocked before reactor threads start, so every thread
+    // inherits the mask and only this loop ever sees SIGINT/SIGTERM.
     io::io_service ep;
-    signal_fd ignore(ep,[](signalfd_siginfo){},{SIGPIPE});
-    proxy_server proxyServer(ep, ipv4_endpoint(8080, ipv4_address::any()),10);
+    bool stop = false;
+    signal_fd ignore(ep, [](signalfd_siginfo)
+    { }, {SIGPIPE});
+    signal_fd terminate(ep, [&stop](signalfd_siginfo)
+    {
+        INFO("Catched SIGINT or SIGTERM");
+        stop = true;
+    }, {SIGINT, SIGTERM});
+
+    if (diskMegabytes) options.diskBudget = diskMegabytes * 1024 * 1024 / reactors;
+    if (!diskDirectory.empty() && mkdir(diskDirectory.c_str(), 0755) == -1 && errno != EEXIST) {
+        throw_error(errno, "mkdir(--disk-cache)");
+    }
+
+    if (reactors > 1) options.dnsCache = std::make_shared<dns_cache>(dns_cache::defaultSize);
+    if (reactors > 1) options.metrics = std::make_shared<proxy_metrics>();
 
-    ipv4_endpoint echo_server_endpoint = proxyServer.local_endpoint();
-    std::cout << "bound to " << echo_server_endpoint << std::endl;
+    std::vector<std::unique_ptr<reactor>> pool;
+    for (size_t i = 0; i < reactors; i++) {
+        // every reactor owns a subdirectory, reused after a restart with the same count
+        if (!diskDirectory.empty()) options.diskCache = diskDirectory + "/" + std::to_string(i);
+        pool.emplace_back(new reactor(ipv4_endpoint(8080, ipv4_address::any()), options));
+    }
+    std::cout << "bound to " << pool.front()->local_endpoint() << " with " << reactors << " reactor(s)" << std::endl;
+    if (options.admin) std::cout << "metrics on " << options.admin.get() << std::endl;
+    for (auto &r : pool) r->start();
 
+    ep.setCallback([&stop]()
+                   { return stop ? 1 : 0; });
     ep.run();
+    for (auto &r : pool) r->shutdown();
+    for (auto &r : pool) r->join();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,152 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <sstream>
+#include "metrics.h"
+
+constexpr const unsigned histogram::subBits;
+
+constexpr const unsigned histogram::subCount;
+
+constexpr const unsigned histogram::maxBits;
+
+constexpr const unsigned histogram::bucketCount;
+
+namespace
+{
+    // Prometheus wants seconds; every bound and sum here is whole microseconds
+    std::string seconds(uint64_t micros)
+    {
+        char text[32];
+        snprintf(text, sizeof text, "%llu.%06llu",
+                 static_cast<unsigned long long>(micros / 1000000),
+                 static_cast<unsigned long long>(micros % 1000000));
+        return text;
+    }
+    void counter(std::ostream &out, const char *name, const char *help, uint64_t value)
+    {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " counter\n"
+            << name << ' ' << value << '\n';
+    }
+    void gauge(std::ostream &out, const char *name, const char *help, uint64_t value)
+    {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " gauge\n"
+            << name << ' ' << value << '\n';
+    }
+    void family(std::ostream &out, const char *name, const char *help)
+    {
+        out << "# HELP " << name << ' ' << help << "\n# TYPE " << name << " histogram\n";
+    }
+}
+
+histogram::histogram()
+    : total(0), sum(0)
+{
+    for (auto &bucket : buckets) bucket.store(0, std::memory_order_relaxed);
+}
+// Values below subCount get a bucket each, above that a bucket spans
+// 1/subCount of its power of two
+unsigned histogram::bucket_of(uint64_t micros)
+{
+    if (micros < subCount) return static_cast<unsigned>(micros);
+    unsigned magnitude = 63 - __builtin_clzll(micros);
+    if (magnitude >= maxBits) return bucketCount - 1;
+    unsigned sub = static_cast<unsigned>(micros >> (magnitude - subBits)) & (subCount - 1);
+    return (magnitude - subBits + 1) * subCount + sub;
+}
+uint64_t histogram::lower_bound(unsigned bucket)
+{
+    if (bucket < subCount) return bucket;
+    unsigned magnitude = bucket / subCount + subBits - 1;
+    return static_cast<uint64_t>(subCount + bucket % subCount) << (magnitude - subBits);
+}
+void histogram::record(uint64_t micros)
+{
+    buckets[bucket_of(micros)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(micros, std::memory_order_relaxed);
+}
+void histogram::record(clock_t::duration elapsed)
+{
+    auto micros = std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count();
+    record(static_cast<uint64_t>(std::max<decltype(micros)>(micros, 0)));
+}
+void histogram::record_since(clock_t::time_point start)
+{
+    record(clock_t::now() - start);
+}
+uint64_t histogram::count() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+uint64_t histogram::quantile(double q) const
+{
+    uint64_t rank = static_cast<uint64_t>(std::ceil(q * count()));
+    uint64_t seen = 0;
+    for (unsigned i = 0; i < bucketCount; i++) {
+        seen += buckets[i].load(std::memory_order_relaxed);
+        if (seen >= rank && seen != 0) return lower_bound(i + 1);
+    }
+    return 0;
+}
+// Counts are read one by one while other threads record, so a scrape may
+// be off by the samples added meanwhile; the cumulative counts stay monotonic
+void histogram::write(std::ostream &out, const char *name, const std::string &labels) const
+{
+    std::string prefix = labels.empty() ? std::string() : labels + ",";
+    uint64_t cumulative = 0;
+    unsigned next = 0;
+    for (unsigned magnitude = subBits; magnitude <= maxBits; magnitude++) {
+        unsigned end = (magnitude - subBits + 1) * subCount; // buckets below 2^magnitude
+        for (; next < end; next++) cumulative += buckets[next].load(std::memory_order_relaxed);
+        // le is inclusive and values are whole microseconds: below 2^m is at most 2^m - 1
+        out << name << "_bucket{" << prefix << "le=\"" << seconds((uint64_t(1) << magnitude) - 1) << "\"} "
+            << cumulative << '\n';
+    }
+    for (; next < bucketCount; next++) cumulative += buckets[next].load(std::memory_order_relaxed);
+    out << name << "_bucket{" << prefix << "le=\"+Inf\"} " << cumulative << '\n';
+    std::string braces = labels.empty() ? std::string() : "{" + labels + "}";
+    out << name << "_sum" << braces << ' ' << seconds(sum.load(std::memory_order_relaxed)) << '\n';
+    out << name << "_count" << braces << ' ' << cumulative << '\n';
+}
+
+std::string proxy_metrics::exposition() const
+{
+    std::ostringstream out;
+    family(out, "proxy_headers_seconds", "Time from accept, or a later request's first byte, to its headers parsed.");
+    headers.write(out, "proxy_headers_seconds", "");
+    family(out, "proxy_resolve_seconds", "Time waiting for the origin address.");
+    resolve.write(out, "proxy_resolve_seconds", "");
+    family(out, "proxy_connect_seconds", "Time to open a new upstream connection.");
+    connect.write(out, "proxy_connect_seconds", "");
+    family(out, "proxy_first_byte_seconds", "Time from request forwarded to the first response byte.");
+    firstByte.write(out, "proxy_first_byte_seconds", "");
+    family(out, "proxy_last_byte_seconds", "Time from request forwarded to the response complete.");
+    lastByte.write(out, "proxy_last_byte_seconds", "");
+    family(out, "proxy_exchange_seconds", "Time from request dispatched to response queued, by cache outcome.");
+    freshHit.write(out, "proxy_exchange_seconds", "cache=\"fresh\"");
+    revalidated.write(out, "proxy_exchange_seconds", "cache=\"revalidated\"");
+    miss.write(out, "proxy_exchange_seconds", "cache=\"miss\"");
+
+    uint64_t accepted = connectionsAccepted.load(std::memory_order_relaxed);
+    uint64_t closed = connectionsClosed.load(std::memory_order_relaxed);
+    counter(out, "proxy_connections_accepted_total", "Client connections accepted.", accepted);
+    gauge(out, "proxy_connections_open", "Client connections open.", accepted > closed ? accepted - closed : 0);
+    counter(out, "proxy_requests_total", "Requests parsed.", requests.load(std::memory_order_relaxed));
+    counter(out, "proxy_upstream_connects_total", "Upstream connections opened.",
+            upstreamConnects.load(std::memory_order_relaxed));
+    counter(out, "proxy_upstream_reused_total", "Requests sent over a pooled upstream connection.",
+            upstreamReused.load(std::memory_order_relaxed));
+    counter(out, "proxy_client_bytes_total", "Bytes read from clients.", clientBytes.load(std::memory_order_relaxed));
+    counter(out, "proxy_origin_bytes_total", "Bytes read from origins.", originBytes.load(std::memory_order_relaxed));
+    counter(out, "proxy_cache_bytes_total", "Response bytes sent from the cache.",
+            cacheBytes.load(std::memory_order_relaxed));
+    counter(out, "proxy_cache_fresh_hits_total", "Requests answered from the cache without the origin.",
+            freshHit.count());
+    counter(out, "proxy_cache_revalidated_total", "Requests answered from the cache after a 304.",
+            revalidated.count());
+    counter(out, "proxy_cache_misses_total", "Requests answered by the origin.", miss.count());
+    counter(out, "proxy_dns_hits_total", "Names found in the DNS cache.", dnsHits.load(std::memory_order_relaxed));
+    counter(out, "proxy_dns_misses_total", "Names sent to the resolver.", dnsMisses.load(std::memory_order_relaxed));
+    return out.str();
+}
@@ -0,0 +1,73 @@
+#ifndef POLL_EVENT_METRICS_H
+#define POLL_EVENT_METRICS_H
+
+#include <atomic>
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include "timer.h"
+
+// Latency distribution in HDR style: values are grouped by power of two and
+// every power is split into subCount linear steps, so any recorded value is
+// off by at most 1/subCount of itself, from a microsecond to a minute.
+// record() is three relaxed atomic adds: reactors share a histogram without a lock.
+class histogram
+{
+public:
+    typedef io::timer::timer_service::clock_t clock_t;
+    constexpr static const unsigned subBits = 3;
+    constexpr static const unsigned subCount = 1u << subBits;
+    constexpr static const unsigned maxBits = 26; // microseconds, about 67 s
+    constexpr static const unsigned bucketCount = (maxBits - subBits + 1) * subCount + 1; // the last for longer ones
+    histogram();
+    histogram(const histogram &) = delete;
+    histogram &operator=(const histogram &) = delete;
+    void record(uint64_t micros);
+    void record(clock_t::duration);
+    void record_since(clock_t::time_point start);
+    uint64_t count() const;
+    // An upper bound of the value at the given rank, 0.99 for p99, in microseconds
+    uint64_t quantile(double) const;
+    // Prometheus text format, a bucket up to every power of two less one; `labels` are
+    // put inside each sample's braces, like `cache="hit"`, or empty
+    void write(std::ostream &, const char *name, const std::string &labels) const;
+private:
+    static unsigned bucket_of(uint64_t micros);
+    static uint64_t lower_bound(unsigned bucket);
+    std::atomic<uint64_t> buckets[bucketCount];
+    std::atomic<uint64_t> total;
+    std::atomic<uint64_t> sum; // microseconds
+};
+
+// Everything the proxy counts, shared by all reactors. Counters only grow;
+// rates and hit ratios are left to whoever scrapes them.
+struct proxy_metrics
+{
+    // Per request phase
+    histogram headers; // accept, or a later request's first byte, to its headers parsed
+    histogram resolve; // waiting for the origin's address, cache hits included
+    histogram connect; // new upstream connections only
+    histogram firstByte; // request forwarded to the first byte of the response
+    histogram lastByte; // request forwarded to the response complete
+    histogram freshHit; // request dispatched to response queued, per cache outcome
+    histogram revalidated;
+    histogram miss;
+
+    std::atomic<uint64_t> connectionsAccepted{0};
+    std::atomic<uint64_t> connectionsClosed{0};
+    std::atomic<uint64_t> requests{0};
+    std::atomic<uint64_t> upstreamConnects{0};
+    std::atomic<uint64_t> upstreamReused{0};
+    std::atomic<uint64_t> clientBytes{0}; // read from clients
+    std::atomic<uint64_t> originBytes{0}; // read from origins, spliced ones included
+    std::atomic<uint64_t> cacheBytes{0}; // sent from proxycache
+    std::atomic<uint64_t> dnsHits{0};
+    std::atomic<uint64_t> dnsMisses{0};
+
+    static void add(std::atomic<uint64_t> &counter, uint64_t n = 1)
+    { counter.fetch_add(n, std::memory_order_relaxed); }
+    std::string exposition() const;
+};
+
+
+#endif //POLL_EVENT_METRICS_H
@@ -0,0 +1,77 @@
+#ifndef POLL_EVENT_MPSC_QUEUE_H
+#define POLL_EVENT_MPSC_QUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <utility>
+
+// Completions handed from any number of threads to one consumer without a
+// lock. A push is one CAS onto a list, a drain takes the whole list with one
+// exchange. Only the push that finds the list empty has to wake the consumer:
+// anything pushed after it is taken by the drain that wakeup leads to.
+template<typename T>
+class mpsc_queue
+{
+public:
+    mpsc_queue() = default;
+    mpsc_queue(const mpsc_queue &) = delete;
+    mpsc_queue &operator=(const mpsc_queue &) = delete;
+    ~mpsc_queue()
+    { release(top.exchange(nullptr, std::memory_order_acquire)); }
+    // True if the consumer has to be woken up
+    bool push(T value)
+    {
+        node *n = new node{std::move(value), nullptr};
+        node *head = top.load(std::memory_order_relaxed);
+        do {
+            n->next = head;
+        } while (!top.compare_exchange_weak(head, n, std::memory_order_release, std::memory_order_relaxed));
+        return head == nullptr;
+    }
+    // Hands everything pushed so far to `consume`, oldest first
+    template<typename F>
+    size_t drain(F consume)
+    {
+        node *ordered = nullptr; // the list is newest first
+        for (node *n = top.exchange(nullptr, std::memory_order_acquire); n;) {
+            node *next = n->next;
+            n->next = ordered;
+            ordered = n;
+            n = next;
+        }
+        size_t count = 0;
+        try {
+            while (ordered) {
+                node *n = ordered;
+                ordered = n->next;
+                T value = std::move(n->value);
+                delete n;
+                count++;
+                consume(std::move(value));
+            }
+        }
+        catch (...) {
+            release(ordered);
+            throw;
+        }
+        return count;
+    }
+private:
+    struct node
+    {
+        T value;
+        node *next;
+    };
+    static void release(node *n)
+    {
+        while (n) {
+            node *next = n->next;
+            delete n;
+            n = next;
+        }
+    }
+    std::atomic<node *> top{nullptr};
+};
+
+
+#endif //POLL_EVENT_MPSC_QUEUE_H
@@ -0,0 +1,45 @@
+#include <algorithm>
+#include <limits.h>
+#include <sys/uio.h>
+#include "output_chain.h"
+
+void output_chain::push(outstring out)
+{
+    if (out.size() == 0) return;
+    pending += out.size();
+    segments.push_back(std::move(out));
+}
+bool output_chain::empty() const
+{
+    return segments.empty();
+}
+size_t output_chain::bytes() const
+{
+    return pending;
+}
+size_t output_chain::flush(connection &socket)
+{
+    size_t total = 0;
+    while (!segments.empty()) {
+        iovec iov[IOV_MAX];
+        int count = 0;
+        size_t requested = 0;
+        for (auto it = segments.begin(); it != segments.end() && count < IOV_MAX; ++it, ++count) {
+            iov[count].iov_base = const_cast<char *>(it->get());
+            iov[count].iov_len = it->size();
+            requested += it->size();
+        }
+        size_t written = socket.writev_over_connection(iov, count);
+        total += written;
+        pending -= written;
+        for (size_t left = written; left > 0;) {
+            outstring &front = segments.front();
+            size_t part = std::min(left, front.size());
+            front += part;
+            left -= part;
+            if (front) segments.pop_front();
+        }
+        if (written < requested) break; // the socket is full
+    }
+    return total;
+}
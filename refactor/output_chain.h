@@ -0,0 +1,24 @@
+#ifndef POLL_EVENT_OUTPUT_CHAIN_H
+#define POLL_EVENT_OUTPUT_CHAIN_H
+
+#include "fifo.h"
+#include "outstring.h"
+#include "connection.h"
+
+// Pending writes of one socket, in order. Segments reference their bytes
+// (see outstring) and a flush hands up to IOV_MAX of them to one writev().
+class output_chain
+{
+public:
+    void push(outstring);
+    bool empty() const;
+    size_t bytes() const;
+    // Writes until the socket would block or the chain is empty
+    size_t flush(connection &);
+private:
+    fifo<outstring> segments;
+    size_t pending = 0;
+};
+
+
+#endif //POLL_EVENT_OUTPUT_CHAIN_H
@@ -3,27 +3,37 @@
 //
 
 #include "outstring.h"
-outstring::outstring(std::string string):text(string)
+outstring::outstring(std::string string):outstring(std::make_shared<const std::string>(std::move(string)))
 {
 
 }
 const char *outstring::get()
 {
-    return &text.c_str()[pp];
+    return data + pp;
 }
 size_t outstring::size()
 {
-    return text.length()-pp;
+    return length-pp;
 }
 outstring::operator bool()
 {
-    return pp>=text.length();
+    return pp>=length;
 }
 void outstring::operator+=(size_t t)
 {
     pp+=t;
 }
-outstring::outstring(std::string string, size_t t):text(string),pp(t)
+outstring::outstring(std::string string, size_t t):outstring(std::move(string))
+{
+    pp = t;
+}
+outstring::outstring(std::shared_ptr<const std::string> shared)
+    :owner(shared), data(shared->data()), length(shared->size())
+{
+
+}
+outstring::outstring(std::shared_ptr<const void> owner, const char *data, size_t length)
+    :owner(std::move(owner)), data(data), length(length)
 {
 
 }
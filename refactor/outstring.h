@@ -5,12 +5,20 @@
 #ifndef POLL_EVENT_OUTSTRING_H
 #define POLL_EVENT_OUTSTRING_H
 #include <string>
+#include <memory>
+// A pending write. The bytes are shared and never modified, so copying an
+// outstring or sending one buffer to many clients doesn't copy the text.
+// `owner` keeps them alive: a string, or a mapping for disk cache hits.
 struct outstring{
-    std::string text;
+    std::shared_ptr<const void> owner;
+    const char *data;
+    size_t length;
     size_t pp=0;
 
     outstring(std::string);
     outstring(std::string,size_t);
+    outstring(std::shared_ptr<const std::string>);
+    outstring(std::shared_ptr<const void>, const char *, size_t);
     const char * get();
     size_t size();
     explicit operator bool();
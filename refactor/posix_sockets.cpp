@@ -6,6 +6,7 @@
 #include <netinet/in.h>
 #include <string>
 #include <fcntl.h>
+#include <sys/uio.h>
 #include "epoll_error.h"
 #include "handle.h"
 
@@ -74,14 +75,27 @@ size_t write_some(handle& fd, void const* data, std::size_t size)
     return static_cast<size_t>(res);
 }
 
+size_t writev_some(handle& fd, const struct iovec *iov, int count)
+{
+    ssize_t res = writev(fd.get_raw(), iov, count);
+    if (res == -1)
+    {
+        int err = errno;
+        if (err == EAGAIN || err == ECONNRESET)
+            return 0;
+        throw_error(err, "writev()");
+    }
+    return static_cast<size_t>(res);
+}
+
 void write_all(handle& fdc, const char *data, std::size_t size)
 {
 
-    ssize_t total_bytes_written = 0;
+    std::size_t total_bytes_written = 0;
     while (total_bytes_written != size)
     {
-        ssize_t written = write_some(fdc, &data[total_bytes_written], size-total_bytes_written);
-        if(written <= 0){
+        std::size_t written = write_some(fdc, &data[total_bytes_written], size-total_bytes_written);
+        if(written == 0){
             break;
         }
         total_bytes_written+=written;
@@ -97,6 +111,12 @@ void write(handle& fd, std::string const& str)
     write_all(fd, str.data(), str.size());
 }
 
+void shutdown_write(handle& fd)
+{
+    if (shutdown(fd.get_raw(), SHUT_WR) == -1 && errno != ENOTCONN)
+        throw_error(errno, "shutdown()");
+}
+
 ssize_t read_some(handle& fd, void* data, size_t size)
 {
     ssize_t res = ::read(fd.get_raw(), data, size);
@@ -16,5 +16,7 @@ void set_fd_flags(handle &fd, int flags);
 void write(handle &fd, std::string const &str);
 ssize_t read_some(handle &fd, void *data, size_t size);
 size_t write_some(handle &fd, void const *data, std::size_t size);
+size_t writev_some(handle &fd, const struct iovec *iov, int count);
 void write_all(handle &fdc, const char *data, std::size_t size);
+void shutdown_write(handle &fd);
 #endif //POLL_EVENT_POSIX_SOCKETS_H
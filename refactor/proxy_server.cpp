@@ -1,4 +1,7 @@
 #include <netdb.h>
+#include <strings.h>
+#include <cstring>
+#include <algorithm>
 #include <boost/bind.hpp>
 #include <thread>
 #include "HTTP.h"
@@ -9,94 +12,308 @@ constexpr const io::timer::timer_service::clock_t::duration proxy_server::connec
 
 constexpr const io::timer::timer_service::clock_t::duration proxy_server::idleTimeout;
 
+constexpr const size_t proxy_server::relayThreshold;
+
+constexpr const io::timer::timer_service::clock_t::duration proxy_server::upstreamIdleTimeout;
+
+constexpr const io::timer::timer_service::clock_t::duration proxy_server::tunnelIdleTimeout;
+
+constexpr const size_t proxy_server::upstreamMaxIdle;
+
+constexpr const size_t proxy_server::upstreamMaxPerHost;
+
+constexpr const size_t proxy_server::cacheBudget;
+
+constexpr const size_t proxy_server::readRounds;
+
+constexpr const size_t proxy_server::pipelineDepth;
+
+constexpr const size_t proxy_server::highWatermark;
+
+constexpr const size_t proxy_server::lowWatermark;
+
+constexpr const size_t proxy_server::diskSlabSize;
+
+constexpr const size_t proxy_server::diskThreshold;
+
 proxy_server::inbound::inbound(proxy_server *parent)
-    : parent(parent), timer(parent->ios->getClock(), proxy_server::idleTimeout, [this]
-{
-    LOG("Sock(inbound) %d timed out. Disconnecting", this->socket.getFd().get_raw());
-    this->socket.forceDisconnect();
-}),
-      socket(parent->ss.accept(
+    : parent(parent), socket(parent->ss.accept(
           [this]
           {
               LOG("Disconnected sock %d", this->socket.getFd().get_raw());
               getSocketError(this->socket.getFd());
-              if (assigned) {
+              proxy_metrics::add(this->parent->stats->connectionsClosed);
+              if (assigned && assigned->socket) {
                   INFO("Disconnecting assigned socket");
                   assigned->socket->forceDisconnect();
               }
               this->parent->connections.erase(this);
-          }))
+          })),
+      timer(parent->ios->getClock(), proxy_server::idleTimeout, [this]
+      {
+          LOG("Sock(inbound) %d timed out. Disconnecting", this->socket.getFd().get_raw());
+          this->socket.forceDisconnect();
+      })
 {
+    proxy_metrics::add(parent->stats->connectionsAccepted);
+    requestStart = histogram::clock_t::now();
     wakeUp();
 }
 
 void proxy_server::inbound::handleRead()
 {
-    size_t n = socket.get_available_bytes();
-    LOG("(%d):Bytes available: %lu ", socket.getFd().get_raw(), n);
-    if (n < 1) {
-        LOG("(%d):No bytes available. EOF.", socket.getFd().get_raw());
-        socket.forceDisconnect();
-        return;
+    std::shared_ptr<char> buffer = parent->buffers.acquire();
+    for (size_t round = 0; round < proxy_server::readRounds; round++) {
+        if (closing || stopped || uploadPaused || pipeline.size() >= proxy_server::pipelineDepth) return; // wakeUp() stopped reads
+        auto res = socket.read_over_connection(buffer.get(), buffer_pool::bufferSize);
+        if (res == -1) return; // drained
+        if (res == 0) {
+            LOG("(%d):No bytes available. EOF.", socket.getFd().get_raw());
+            socket.forceDisconnect();
+            return;
+        }
+        LOG("(%d):Read %ld bytes", socket.getFd().get_raw(), res);
+        proxy_metrics::add(parent->stats->clientBytes, res);
+        timer.recharge(proxy_server::idleTimeout);
+        parse(buffer.get(), res);
+        if (!closing && assigned && assigned->uploading) assigned->sendBody();
+        startNext();
     }
-    char buff[n + 1];
-    auto res = socket.read_over_connection(buff, n);
-    buff[n] = '\0';
-    if (res == -1) {
-        throw_error(errno, "Inbound::Handleread()");
+}
+// Splits the bytes into requests: one read may end one and begin the next
+void proxy_server::inbound::parse(const char *data, size_t size)
+{
+    if (requestStart == histogram::clock_t::time_point()) requestStart = histogram::clock_t::now();
+    if (!incoming) {
+        std::string text = spareText();
+        text.assign(data, size);
+        incoming = newRequest(std::move(text));
     }
-    if (res == 0) {
-        socket.forceDisconnect();
-        return;
+    else {
+        incoming->add_part(data, size);
     }
-    timer.recharge(proxy_server::idleTimeout);
-    if (!requ) {
-        requ = std::make_shared<request>(std::string(buff));
+    for (;;) {
+        if (incoming->get_state() == request::FAIL) {
+            stopped = true; // the stream can't be framed past this point
+            if (streamed) abortUpload();
+            else pipeline.push_back(incoming);
+            incoming.reset();
+            streamed = false;
+            return;
+        }
+        if (incoming->get_state() == request::BODYPART && !streamed && !incoming->is_connect()) {
+            // answered before its body is in, so an upload isn't held here whole
+            streamed = true;
+            pipeline.push_back(incoming);
+            headersParsed();
+        }
+        if (incoming->get_state() != request::BODYFULL) return;
+        std::string rest = spareText();
+        incoming->take_excess(&rest);
+        bool connect = incoming->is_connect();
+        if (!streamed) {
+            pipeline.push_back(incoming);
+            headersParsed();
+        }
+        incoming.reset();
+        streamed = false;
+        if (connect) {
+            stopped = true; // the rest belongs to the tunnel
+            tunnelPrefix = std::move(rest);
+            return;
+        }
+        if (rest.empty()) {
+            keepSpare(std::move(rest));
+            return;
+        }
+        requestStart = histogram::clock_t::now();
+        incoming = newRequest(std::move(rest));
     }
-    else {
-        requ->add_part(std::string(buff));
+}
+std::shared_ptr<request> proxy_server::inbound::newRequest(std::string text)
+{
+    request_arena *slot = nullptr;
+    for (auto &candidate : arenas) {
+        if (candidate.user.expired()) {
+            slot = &candidate;
+            break;
+        }
+    }
+    if (!slot) {
+        arenas.push_back(request_arena{std::unique_ptr<arena>(new arena()), std::weak_ptr<request>()});
+        slot = &arenas.back();
+    }
+    slot->user.reset();
+    slot->memory->reset(); // nothing of the last request is left in it
+    arena *memory = slot->memory.get();
+    auto made = std::allocate_shared<request>(arena_allocator<request>(memory), std::move(text), memory);
+    slot->user = made;
+    return made;
+}
+void proxy_server::inbound::headersParsed()
+{
+    parent->stats->headers.record_since(requestStart);
+    proxy_metrics::add(parent->stats->requests);
+    requestStart = histogram::clock_t::time_point(); // the next one starts with its first byte
+}
+// Answers queued requests one at a time, so responses go out in request order
+void proxy_server::inbound::startNext()
+{
+    if (dispatching) return; // answered synchronously, the loop below goes on
+    dispatching = true;
+    while (!busy && !closing && !pipeline.empty()) {
+        if (requ) finishRequest();
+        requ = std::move(pipeline.front());
+        pipeline.pop_front();
+        busy = true;
+        dispatchedAt = histogram::clock_t::now();
+        dispatch();
     }
+    dispatching = false;
+    wakeUp();
+}
+void proxy_server::inbound::dispatch()
+{
     if (requ->get_state() == request::FAIL) {
         sendBadRequest();
+        return;
     }
-    else if (requ->get_state() == request::BODYFULL) {
-        parent->getResolver().sendDomainForResolve(requ->get_host());
+    try {
+        keepAlive = requ->is_keep_alive();
+        if (parent->serveFresh(this)) return;
         LOG("(%d):Sent to resolver.", socket.getFd().get_raw());
-        this->resolverConnection =
-            parent->distribution.connect(
-                [this](resolver::resolverNode in)
-                { return this->onResolve(in); });
+        resolveStart = histogram::clock_t::now();
+        requ->get_host(&host);
+        parent->waitResolve(this, host);
+    }
+    catch (std::exception &e) {
+        LOG("(%d):Couldn't proceed request: %s", socket.getFd().get_raw(), e.what());
+        sendBadRequest();
+    }
+}
+// The response to requ is complete in output
+void proxy_server::inbound::exchangeDone()
+{
+    busy = false;
+    if (!keepAlive || bodyPending()) { // the rest of an unfinished body can't be told from the next request
+        closeAfterFlush();
+        return;
+    }
+    startNext();
+}
+// The body of a request that is already being answered can't be framed
+void proxy_server::inbound::abortUpload()
+{
+    if (!bodyPending()) return; // still queued, answered with 400 in turn
+    if (assigned && assigned->resp) {
+        closeAfterFlush(); // the response has started, a 400 can't follow it
+    }
+    else {
+        sendBadRequest();
     }
 }
+// requ is streamed and the client is still sending its body
+bool proxy_server::inbound::bodyPending() const
+{
+    return streamed && requ && requ == incoming;
+}
+// Body bytes received but not yet taken by the origin
+size_t proxy_server::inbound::uploadBacklog() const
+{
+    size_t held = streamed ? incoming->get_held_length() : 0;
+    if (assigned && assigned->uploading) held += assigned->output.bytes();
+    return held;
+}
+void proxy_server::inbound::closeAfterFlush()
+{
+    closing = true;
+    busy = false;
+    pipeline.clear();
+    wakeUp(); // handleWrite() disconnects once everything is sent
+}
+// Error pages say "Connection: close", and the connection does close after them
 void proxy_server::inbound::sendBadRequest()
 {
+    if (closing) return; // already ends with an error
     output.push(HTTP::placeholder());
-    wakeUp();
+    closeAfterFlush();
 }
 void proxy_server::inbound::sendNotFound()
 {
+    if (closing) return;
     output.push(HTTP::notFound());
-    wakeUp();
+    closeAfterFlush();
+}
+void proxy_server::inbound::sendCached(const cache_ref &page, long age)
+{
+    // headers are rebuilt to carry our Age, the body is sent from the entry
+    const char *begin = page->text.data, *end = begin + page->text.length;
+    const char *body = std::search(begin, end, "\r\n\r\n", "\r\n\r\n" + 4);
+    if (body == end) throw std::runtime_error("cached page without headers");
+    std::string head;
+    for (const char *line = begin; line < body;) {
+        const char *eol = std::search(line, body, "\r\n", "\r\n" + 2);
+        if (line == begin || strncasecmp(line, "Age:", 4) != 0) head.append(line, eol + 2);
+        line = eol + 2;
+    }
+    head += "Age: " + std::to_string(age) + "\r\n\r\n";
+    output.push(outstring(std::move(head)));
+    body += 4;
+    if (body != end) output.push(outstring(page->text.owner, body, end - body));
+    proxy_metrics::add(parent->stats->cacheBytes, page->text.length);
+    parent->stats->freshHit.record_since(dispatchedAt);
+    finishRequest();
+    exchangeDone();
+}
+void proxy_server::inbound::finishRequest()
+{
+    keepSpare(requ->release_text());
+    requ.reset();
+}
+std::string proxy_server::inbound::spareText()
+{
+    if (spares.empty()) return std::string();
+    std::string text = std::move(spares.back());
+    spares.pop_back();
+    return text;
+}
+void proxy_server::inbound::keepSpare(std::string text)
+{
+    if (text.capacity() > arena::maxRetained) return; // a large body, don't keep it
+    if (spares.size() >= proxy_server::pipelineDepth) return;
+    text.clear();
+    spares.push_back(std::move(text));
 }
 void proxy_server::inbound::wakeUp()
 {
-    socket.setOn_rw(std::bind(&inbound::handleRead, this), std::bind(&inbound::handleWrite, this));
+    if (uploadBacklog() >= parent->highWater) uploadPaused = true; // outbound::handleWrite() resumes
+    bool reading = !closing && !stopped && !uploadPaused && pipeline.size() < proxy_server::pipelineDepth;
+    socket.setOn_rw(reading ? [this] { handleRead(); } : connection::callback(),
+                    [this] { handleWrite(); });
 }
 void proxy_server::inbound::handleWrite()
 {
+    if (assigned && assigned->tunnel) {
+        flushTunnel();
+        return;
+    }
     if (!output.empty()) {
         timer.recharge(proxy_server::idleTimeout);
-        auto string = &output.front();
-        size_t written = socket.write_over_connection(string->get(), string->size());
-        string->operator+=(written);
+        size_t written = output.flush(socket);
         LOG("(%d):Written %lu bytes to client", socket.getFd().get_raw(), written);
-        if (*string) {
-            output.pop();
-            INFO("Written all");
-        }
     }
-    if (output.empty()) {
-        if (assigned) assigned->askMore();
+    if (output.empty() && !relay.empty()) {
+        timer.recharge(proxy_server::idleTimeout);
+        size_t written = relay.drain(socket.getFd());
+        LOG("(%d):Spliced %lu bytes to client", socket.getFd().get_raw(), written);
+    }
+    if (assigned && belowLowWater()) assigned->askMore();
+    if (output.empty() && relay.empty()) {
+        if (closing) {
+            LOG("(%d):Response sent, closing", socket.getFd().get_raw());
+            socket.forceDisconnect();
+            return;
+        }
         socket.setOn_write(connection::callback());
     }
 }
@@ -107,30 +324,50 @@ proxy_server::proxy_server(io::io_service &ep, ipv4_endpoint const &local_endpoi
     domainResolver.resize(t);
 }
 proxy_server::proxy_server(io::io_service &ep, ipv4_endpoint const &local_endpoint)
-    : ss{ep, local_endpoint, std::bind(&proxy_server::on_new_connection, this)},
-      sigfd{ep, [this](signalfd_siginfo)
+    : stopEvent(ep, [this](uint64_t)
       {
-          INFO("Catched SIGINT or SIGTERM");
+          INFO("Shutdown requested");
           this->stop = true;
-      }, {SIGINT, SIGTERM}},
-      resolveEvent(ep, true, [this](uint32_t)
+      }),
+      resolveEvent(ep, false, [this](uint64_t)
       {
-          auto target = domainResolver.getFirst();
-          distribution(target);
-      }), domainResolver(resolveEvent, 5), proxycache(10000)
+          // one read for all lookups finished since the last, however many signalled
+          domainResolver.drain([this](const resolver::resolverNode &result)
+                               {
+                                   try {
+                                       onResolved(result);
+                                   }
+                                   catch (std::exception &e) {
+                                       LOG("Couldn't proceed resolved %s: %s", result.host.c_str(), e.what());
+                                   }
+                               });
+      }), ss{ep, local_endpoint, std::bind(&proxy_server::on_new_connection, this)},
+      domainResolver(resolveEvent, 5),
+      upstreams(ep, upstreamMaxIdle, upstreamMaxPerHost, upstreamIdleTimeout), buffers(idleBuffers), proxycache(cacheBudget), dnsCache(std::make_shared<dns_cache>(dns_cache::defaultSize)),
+      stats(std::make_shared<proxy_metrics>())
 {
     ios = &ep;
     ep.setCallback([this]()
                    {
 #ifdef DEBUG
-                       static int counter = 0;
-                       counter++;
+                       idleTicks++;
 
-                       if (counter % 10 == 0) {
+                       if (idleTicks % 10 == 0) {
                            LOG("Now connected: %lu", this->connections.size());
-                           LOG("Cache entries DNS: %lu, pages: %lu",
-                               this->domainResolver.cacheSize(),
-                               this->proxycache.size());
+                           LOG("Cache entries DNS: %lu, pages: %lu (%lu bytes, %lu evicted)",
+                               this->dnsCache->size(),
+                               this->proxycache.size(),
+                               this->proxycache.cost(),
+                               this->proxycache.evictions());
+                           LOG("Responses: %lu, p50 %lu us, p99 %lu us",
+                               this->stats->lastByte.count(),
+                               this->stats->lastByte.quantile(0.5),
+                               this->stats->lastByte.quantile(0.99));
+                           if (this->diskCache) {
+                               LOG("Disk cache: %lu pages, %lu bytes",
+                                   this->diskCache->size(),
+                                   this->diskCache->bytes());
+                           }
                        }
 #endif
                        return (stop && this->connections.size() == 0)
@@ -139,6 +376,10 @@ proxy_server::proxy_server(io::io_service &ep, ipv4_endpoint const &local_endpoi
                    });
 }
 
+void proxy_server::shutdown()
+{
+    stopEvent.add();
+}
 ipv4_endpoint proxy_server::local_endpoint() const
 {
     return ss.local_endpoint();
@@ -157,23 +398,78 @@ void proxy_server::on_new_connection()
     inbound *pcc = cc.get();
     connections.emplace(pcc, std::move(cc));
 }
-bool proxy_server::inbound::onResolve(resolver::resolverNode result)
+void proxy_server::waitResolve(inbound *in, const std::string &host)
+{
+    bool refresh;
+    auto cached = dnsCache->lookup(host, io::timer::timer_service::clock_t::now(), refresh);
+    if (cached) {
+        LOG("DNS hit: %s", host.c_str());
+        proxy_metrics::add(stats->dnsHits);
+        const resolver::resolverNode &result = *cached;
+        if (refresh && waiters.find(host) == waiters.end()) {
+            // an empty waiter list marks the lookup as in flight
+            waiters[host];
+            resolve(host);
+        }
+        answer(in, result);
+        return;
+    }
+    proxy_metrics::add(stats->dnsMisses);
+    bool first = waiters.find(host) == waiters.end();
+    auto &list = waiters[host];
+    in->waitPosition = list.insert(list.end(), in);
+    in->waiting = true;
+    if (first) resolve(host); // may answer synchronously, so the waiter is queued before
+}
+void proxy_server::onResolved(const resolver::resolverNode &result)
+{
+    dnsCache->store(result, io::timer::timer_service::clock_t::now());
+    auto it = waiters.find(result.host);
+    if (it == waiters.end()) return;
+    auto &list = it->second; // element references survive rehashing
+    while (!list.empty()) {
+        inbound *waiter = list.front();
+        list.pop_front();
+        waiter->waiting = false;
+        answer(waiter, result);
+    }
+    waiters.erase(result.host);
+}
+void proxy_server::answer(inbound *in, const resolver::resolverNode &result)
+{
+    try {
+        in->onResolve(result);
+    }
+    catch (std::exception &e) {
+        LOG("Couldn't proceed resolved %s: %s", result.host.c_str(), e.what());
+        in->sendBadRequest();
+    }
+}
+void proxy_server::inbound::onResolve(const resolver::resolverNode &result)
 {
-    if (result.host != requ->get_host()) return false;
-    this->resolverConnection.disconnect();
+    if (closing) return; // the body broke off while the name was resolved
+    parent->stats->resolve.record_since(resolveStart);
     if (!result.resolvedHost) {
         sendNotFound();
     }
+    else if (requ->is_connect()) {
+        assigned = std::make_shared<outbound>(this); // a tunnel never shares its connection
+        assigned->openTunnel(result.resolvedHost.get());
+        finishRequest();
+    }
     else {
         if(!assigned) assigned = std::make_shared<outbound>(this);
-        if(assigned->getHost()!=requ->get_host()) assigned->perform_connection(result.resolvedHost.get());
+        if(!assigned->socket || assigned->getHost()!=host) assigned->perform_connection(result.resolvedHost.get());
 #ifdef DEBUG
-        if(assigned->getHost() == requ->get_host()) INFO("FAST PATH");
+        if(assigned->getHost() == host) INFO("FAST PATH");
 #endif
+        if (bodyPending() && requ->expects_continue()) {
+            outstring proceed(std::string("HTTP/1.1 100 Continue\r\n\r\n"));
+            trySend(proceed);
+        }
         assigned->form_request();
-        requ.reset();
+        if (!bodyPending()) finishRequest(); // otherwise its text keeps framing the body
     }
-    return true;
 }
 proxy_server::~proxy_server()
 {
@@ -182,7 +478,16 @@ proxy_server::outbound::outbound(inbound *ass)
     :
     assigned(ass), parent(ass->parent)
 {}
-void proxy_server::outbound::perform_connection(ipv4_endpoint endpoint){
+void proxy_server::outbound::perform_connection(ipv4_endpoint endpoint, bool pooled){
+    this->endpoint = endpoint;
+    if (pooled) socket = parent->upstreams.checkout(endpoint);
+    if (socket) {
+        socket->setOn_disconnect([this] { onDisconnect(); });
+        return;
+    }
+    proxy_metrics::add(parent->stats->upstreamConnects);
+    connecting = true;
+    connectStart = histogram::clock_t::now();
     timer = io::timer::timer_element(parent->ios->getClock(),
         proxy_server::connectionTimeout,
         [this]()
@@ -191,143 +496,571 @@ void proxy_server::outbound::perform_connection(ipv4_endpoint endpoint){
             assigned->sendNotFound();
             socket->forceDisconnect();
         });
-    socket = std::unique_ptr<connection>(new connection(connection::connect(*parent->ios,endpoint,[&]()
-    {
-        LOG("Disconnected from (%d):%s", socket->getFd().get_raw(),host.c_str());
-        if (socket->get_available_bytes() != 0) {
-            LOG("(%d): Disconnected with available BYTES!!!", socket->getFd().get_raw());
-        }
-        if (getSocketError(this->socket->getFd()) != 0) {
-            assigned->sendBadRequest();
+    socket = std::unique_ptr<connection>(new connection(connection::connect(*parent->ios,endpoint,
+                                                                            [this] { onDisconnect(); })));
+}
+void proxy_server::outbound::onDisconnect()
+{
+    LOG("Disconnected from (%d):%s", socket->getFd().get_raw(),host.c_str());
+    if (socket->get_available_bytes() != 0) {
+        LOG("(%d): Disconnected with available BYTES!!!", socket->getFd().get_raw());
+    }
+    getSocketError(this->socket->getFd());
+    if (tunnel && !inFlight) {
+        // a hangup comes with unread bytes queued, they still go to the client
+        assigned->takeTunnelTail(*socket);
+        assigned->closeAfterFlush();
+    }
+    else if (inFlight && resp && resp->is_close_delimited()) {
+        // the hangup ends the response, bytes still queued are part of it
+        std::shared_ptr<char> buffer = parent->buffers.acquire();
+        ssize_t res;
+        while (resp && (res = socket->read_over_connection(buffer.get(), buffer_pool::bufferSize)) > 0) {
+            proxy_metrics::add(parent->stats->originBytes, res);
+            onChunk(outstring(std::string(buffer.get(), res)));
         }
-        assigned->assigned.reset();
-    })));
+        finishAtClose();
+        return;
+    }
+    else if (inFlight) {
+        // the client only learns where a cut off response ends by the close
+        if (resp) assigned->closeAfterFlush();
+        else assigned->sendBadRequest();
+    }
+    assigned->assigned.reset();
+}
+void proxy_server::outbound::finishResponse()
+{
+    if (resp->get_code()[0] == '1') { // interim response, the final one follows
+        dropResponse();
+        return;
+    }
+    bool reuse = resp->is_keep_alive() && !resp->is_close_delimited() && !relaying && !uploading && output.empty();
+    if (resp->is_close_delimited()) assigned->keepAlive = false; // only the close tells the client where it ends
+    parent->stats->lastByte.record_since(sentAt);
+    if (cacheHit && resp->get_code() == "304") {
+        parent->refreshPage(key, cached, *resp);
+        parent->stats->revalidated.record_since(assigned->dispatchedAt);
+    }
+    else {
+        parent->stats->miss.record_since(assigned->dispatchedAt);
+    }
+    if (!toGet && !toHead && (resp->get_code()[0] == '2' || resp->get_code()[0] == '3')) {
+        parent->dropPage(key); // RFC 7234 4.4: an unsafe method that succeeded
+    }
+    try_to_cache();
+    if (resp) dropResponse();
+    cached.reset(); // a 304 already queued its own reference
+    inFlight = false;
+    uploading = false; // answered early, the rest of the body is dropped with the client
+    if (reuse) {
+        parent->upstreams.release(endpoint, std::move(socket));
+    }
+    else {
+        socket.reset(); // the origin closes it, the next request must not go there
+    }
+    assigned->exchangeDone(); // may already send the next request through us
+}
+// The origin closed the connection that delimits the response body
+void proxy_server::outbound::finishAtClose()
+{
+    LOG("(%d):Response ends with the connection", socket->getFd().get_raw());
+    resp->finish_at_close();
+    finishResponse();
 }
 void proxy_server::outbound::form_request(){
     assert(socket);
-    host = assigned->requ->get_host();
-    URI = assigned->requ->get_URI();
+    host = assigned->host;
+    assigned->requ->cache_key(&key);
     validateRequest = assigned->requ->is_validating();
-    cacheHit = parent->proxycache.exists(host + URI);
+    toHead = assigned->requ->get_method() == "HEAD";
+    toGet = assigned->requ->get_method() == "GET";
+    cached = parent->findPage(key);
+    if (cached && (cached->etag == "" || !toGet)) cached.reset(); // nothing to revalidate with, or not a GET
+    cacheHit = static_cast<bool>(cached);
     if (!validateRequest
         && cacheHit) {
-        auto cache_entry = parent->proxycache.get(host + URI);
-        auto etag = cache_entry.get_header("ETag");
-        LOG("Cache hit: %s", URI.c_str());
+        LOG("Cache hit: %s", key.c_str());
         INFO("Validating request");
-        assigned->requ->append_header("If-None-Match", etag);
+        assigned->requ->append_header("If-None-Match", cached->etag);
     }
-    output.push(assigned->requ->get_request_text());
-    socket->setOn_write(std::bind(&outbound::handleWrite, this));
+    size_t length;
+    const char *text = assigned->requ->get_request_text(&length);
+    output.push(outstring(assigned->requ, text, length)); // the request holds its arena
+    assigned->requ->drop_body(); // sent with the headers
+    uploading = assigned->bodyPending();
+    inFlight = true;
+    if (!connecting) proxy_metrics::add(parent->stats->upstreamReused);
+    answered = false;
+    sentAt = histogram::clock_t::now();
+    socket->setOn_write([this] { handleWrite(); });
 }
 void proxy_server::outbound::onRead()
 {
     assert(socket);
-    size_t n = socket->get_available_bytes();
-    char buf[n + 1];
-    ssize_t res = socket->read_over_connection(buf, n);
-    if (res == -1) {
-        throw_error(errno, "onRead()");
-    }
-    if (res == 0) // EOF
-    {
-        LOG("(%d):Outbound EOF. Disconnected", socket->getFd().get_raw());
-        socket->forceDisconnect();
-        return;
+    // stop once the response is complete: the socket may be back in the pool
+    for (size_t round = 0; round < proxy_server::readRounds; round++) {
+        std::shared_ptr<char> buffer = parent->buffers.acquire();
+        ssize_t res = socket->read_over_connection(buffer.get(), buffer_pool::bufferSize);
+        if (res == -1) return; // drained
+        if (res == 0) // EOF
+        {
+            if (resp && resp->is_close_delimited()) {
+                finishAtClose();
+                return;
+            }
+            LOG("(%d):Outbound EOF. Disconnected", socket->getFd().get_raw());
+            socket->forceDisconnect();
+            return;
+        }
+        proxy_metrics::add(parent->stats->originBytes, res);
+        if (static_cast<size_t>(res) < buffer_pool::smallSize) { // don't pin a whole buffer while queued
+            std::shared_ptr<char> small = parent->buffers.acquireSmall();
+            memcpy(small.get(), buffer.get(), res);
+            onChunk(outstring(small, small.get(), res));
+        }
+        else {
+            onChunk(outstring(buffer, buffer.get(), res));
+        }
+        if (!socket || !resp || relaying || cacheHit || assigned->buffered() >= parent->highWater) return;
     }
-    buf[n] = '\0';
+}
+void proxy_server::outbound::onChunk(outstring chunk)
+{
     assigned->timer.recharge(proxy_server::idleTimeout);
+    if (!answered) {
+        answered = true;
+        parent->stats->firstByte.record_since(sentAt);
+    }
     if (!resp) {
-        resp = std::make_shared<response>(std::string(buf, n));
+        memory.reset();
+        spareText.assign(chunk.get(), chunk.size());
+        resp = std::allocate_shared<response>(arena_allocator<response>(&memory), std::move(spareText), &memory,
+                                              toHead);
+        streaming = false;
     }
     else {
-        resp->add_part({buf, n});
+        resp->add_part(chunk.get(), chunk.size());
     }
-    socket->setOn_read(connection::callback());
     if (resp->get_state() >= HTTP::FIRSTLINE && resp->get_code() == "304" && cacheHit) {//NOT MODIFIED 304
         LOG("Cache valid (%d):(%s)", socket->getFd().get_raw(), resp->get_code().c_str());
-        auto cache_entry = parent->proxycache.get(host + URI);
-        outstring out(cache_entry.get_text());
+        outstring out(cached->text);
+        proxy_metrics::add(parent->stats->cacheBytes, out.size());
         assigned->trySend(out);
-        socket->setOn_read(std::bind(&outbound::onReadDiscard, this));
+        socket->setOn_read([this] { onReadDiscard(); });
     }
     else {
         if (cacheHit) {
             LOG("Couldn't use cache (%d):(%s)", socket->getFd().get_raw(), resp->get_code().c_str());
             cacheHit = false; // we need to re-update cache;
         }
-        outstring out(std::string(buf, n));
-        assigned->trySend(out);
+        if (startRelay()) askMore(); // the rest goes through onRelay()
+        assigned->trySend(chunk); // the pooled buffer itself is queued
+        if (!streaming && resp->get_state() == HTTP::BODYPART && !resp->is_storable()) streaming = true;
+        if (streaming) resp->drop_body(); // the client has it queued, it won't be cached
+    }
+    if (resp->get_state() == HTTP::BODYFULL) {
+        finishResponse();
+    }
+    else if (!relaying && !cacheHit && assigned->buffered() >= parent->highWater) {
+        LOG("(%d):Client is behind by %lu bytes, pausing", socket->getFd().get_raw(), assigned->buffered());
+        socket->setOn_read(connection::callback()); // until inbound::handleWrite() drains to the low mark
+    }
+}
+bool proxy_server::outbound::startRelay()
+{
+    if (relaying || resp->get_state() != HTTP::BODYPART || resp->is_storable()
+        || !assigned->relay.empty()) {
+        return false;
+    }
+    size_t total = resp->get_content_length(); // digits only, or the response failed to parse
+    if (total == std::string::npos) return false;
+    size_t received = resp->get_body_length();
+    if (total <= received || total - received < proxy_server::relayThreshold) return false;
+    relayLeft = total - received;
+    relaying = true;
+    LOG("(%d):Relaying %lu bytes with splice()", socket->getFd().get_raw(), relayLeft);
+    return true;
+}
+void proxy_server::outbound::onRelay()
+{
+    assert(socket && relaying);
+    ssize_t res = assigned->relay.fill(socket->getFd(), relayLeft);
+    if (res == -1) return;
+    if (res == 0) {
+        LOG("(%d):Outbound EOF while relaying. Disconnected", socket->getFd().get_raw());
+        socket->forceDisconnect();
+        return;
+    }
+    proxy_metrics::add(parent->stats->originBytes, res);
+    relayLeft -= static_cast<size_t>(res);
+    if (relayLeft == 0) {
+        relaying = false;
+    }
+    assigned->flushRelay();
+    if (!relaying) {
+        finishResponse(); // the body never reached userspace, resp only holds the headers
+    }
+    else if (!assigned->relay.empty()) {
+        // the pipe is the relay's buffer, with no room to measure: wait until it drains
+        socket->setOn_read(connection::callback());
+    }
+}
+void proxy_server::outbound::openTunnel(ipv4_endpoint endpoint)
+{
+    host = assigned->host;
+    perform_connection(endpoint, false);
+    inFlight = true; // until connected: a failure answers the CONNECT with an error
+    LOG("(%d):Opening tunnel to %s", socket->getFd().get_raw(), host.c_str());
+    socket->setOn_write([this] { onTunnelConnected(); });
+}
+void proxy_server::outbound::onTunnelConnected()
+{
+    timer.turnOff();
+    connecting = false;
+    parent->stats->connect.record_since(connectStart);
+    inFlight = false;
+    tunnel = true;
+    LOG("(%d):Tunnel to %s is open", socket->getFd().get_raw(), host.c_str());
+    socket->setOn_rw([this] { onTunnelRead(); }, connection::callback());
+    assigned->startTunnel();
+}
+// Origin to client
+void proxy_server::outbound::onTunnelRead()
+{
+    ssize_t res = assigned->relay.fill(socket->getFd(), proxy_server::relayThreshold);
+    if (res == 0) {
+        LOG("(%d):Origin closed its side of the tunnel", socket->getFd().get_raw());
+        originEOF = true;
+        socket->peer_closed();
+        socket->setOn_read(connection::callback());
+    }
+    else if (res > 0) {
+        proxy_metrics::add(parent->stats->originBytes, res);
+        assigned->timer.recharge(proxy_server::tunnelIdleTimeout);
+    }
+    assigned->flushTunnel(); // may close the tunnel, and destroy this
+}
+// Client to origin: bytes read ahead of the tunnel first, then the pipe
+void proxy_server::outbound::flushUpload()
+{
+    if (!output.empty()) output.flush(*socket);
+    if (output.empty() && !upload.empty()) upload.drain(socket->getFd());
+    if (!output.empty() || !upload.empty()) {
+        socket->setOn_write([this] { flushUpload(); });
+        assigned->socket.setOn_read(connection::callback()); // the pipe has no room, resumed from here
+        return;
+    }
+    socket->setOn_write(connection::callback());
+    if (!clientEOF) {
+        assigned->socket.setOn_read(std::bind(&inbound::onTunnelRead, assigned));
+        return;
+    }
+    if (!originShut) {
+        originShut = true;
+        socket->shutdown_write();
+    }
+    closeTunnelIfDone();
+}
+void proxy_server::outbound::closeTunnelIfDone()
+{
+    if (originShut && clientShut) {
+        LOG("(%d):Tunnel to %s closed by both sides", socket->getFd().get_raw(), host.c_str());
+        assigned->socket.forceDisconnect(); // takes this outbound with it
     }
 }
 
+// Body bytes that arrived since the last call go out after the rest of the request
+void proxy_server::outbound::sendBody()
+{
+    auto &requ = assigned->requ;
+    output.push(outstring(requ->take_body()));
+    if (requ->get_state() == HTTP::BODYFULL) uploading = false;
+    socket->setOn_write([this] { handleWrite(); });
+}
 void proxy_server::outbound::handleWrite()
 {
     assert(socket);
-    if (!output.empty()) {
-        timer.turnOff(); // Connection successful. No need to check connection_timeout
-        auto string = &output.front();
-        size_t written = socket->write_over_connection(string->get(), string->size());
-        string->operator+=(written);
-        if (*string) {
-            output.pop();
-        }
+    timer.turnOff(); // Connection successful. No need to check connection_timeout
+    if (connecting) {
+        connecting = false;
+        parent->stats->connect.record_since(connectStart);
+    }
+    // the response may start before the body is sent; once it has, onChunk() owns reads
+    if (!resp) socket->setOn_read([this] { onRead(); });
+    if (!output.empty() && output.flush(*socket) != 0 && uploading) {
+        assigned->timer.recharge(proxy_server::idleTimeout); // a slow origin isn't an idle client
     }
     if (output.empty()) {
-        socket->setOn_rw(std::bind(&outbound::onRead, this), connection::callback());
+        socket->setOn_write(connection::callback());
+    }
+    if (assigned->uploadPaused && output.bytes() <= parent->lowWater) {
+        assigned->uploadPaused = false;
+        assigned->wakeUp();
     }
 }
 proxy_server::inbound::~inbound()
 {
-    if (resolverConnection.connected()) {
-        resolverConnection.disconnect();
+    if (waiting) {
+        // an empty list is left for onResolved() to erase
+        parent->waiters[host].erase(waitPosition);
     }
 }
 resolver &proxy_server::getResolver()
 {
     return domainResolver;
 }
+void proxy_server::useNameserver(ipv4_endpoint const &nameserver)
+{
+    asyncResolver.reset(new dns_client(*ios, nameserver, [this](const dns_client::answer &result)
+    {
+        if (result.resolved) {
+            onResolved(resolver::resolverNode(result.host, result.resolved.get(), result.ttl));
+        }
+        else {
+            onResolved(resolver::resolverNode(result.host, result.ttl));
+        }
+    }));
+    domainResolver.resize(0);
+}
+void proxy_server::shareDnsCache(std::shared_ptr<dns_cache> shared)
+{
+    dnsCache = std::move(shared);
+}
+void proxy_server::shareMetrics(std::shared_ptr<proxy_metrics> shared)
+{
+    stats = std::move(shared);
+}
+void proxy_server::useAdminPort(ipv4_endpoint const &endpoint)
+{
+    admin.reset(new admin_server(*ios, endpoint, [this]()
+    {
+        return stats->exposition();
+    }));
+}
+void proxy_server::setWatermarks(size_t low, size_t high)
+{
+    highWater = std::max<size_t>(high, 1);
+    lowWater = std::min(low, highWater);
+}
+void proxy_server::setCacheBudget(size_t bytes)
+{
+    proxycache.set_max_size(bytes);
+}
+void proxy_server::useDiskCache(const std::string &directory, size_t bytes)
+{
+    diskCache.reset(new disk_cache(directory, diskSlabSize, bytes / diskSlabSize));
+    proxycache.set_on_evict([this](const std::string &key, const cache_ref &page)
+                            {
+                                diskCache->put(key, page->etag, page->text.data, page->text.length);
+                            });
+}
+proxy_server::cache_ref proxy_server::findPage(const std::string &key)
+{
+    auto entry = proxycache.find(key);
+    if (entry) return *entry;
+    if (diskCache) {
+        auto hit = diskCache->find(key);
+        if (hit) {
+            LOG("Disk cache hit: %s", key.c_str());
+            // freshness isn't kept on disk, such hits are always revalidated
+            return std::make_shared<const cache_entry>(cache_entry{hit->text, hit->etag, {}, 0, 0});
+        }
+    }
+    return cache_ref();
+}
+bool proxy_server::serveFresh(inbound *in)
+{
+    auto &requ = in->requ;
+    if (requ->get_method() != "GET" || requ->is_validating() || requ->is_no_cache()) return false;
+    if (in->bodyPending()) return false; // the body has to be read anyway
+    requ->cache_key(&lookupKey);
+    auto entry = proxycache.find(lookupKey);
+    if (!entry) return false;
+    cache_ref page = *entry;
+    auto resident = io::timer::timer_service::clock_t::now() - page->storedAt;
+    long age = page->initialAge + std::chrono::duration_cast<std::chrono::seconds>(resident).count();
+    if (age >= page->lifetime) return false;
+    LOG("Fresh hit: %s (age %ld of %ld)", lookupKey.c_str(), age, page->lifetime);
+    in->sendCached(page, age);
+    return true;
+}
+void proxy_server::refreshPage(const std::string &key, const cache_ref &page, const response &notModified)
+{
+    // a disk hit would count against the memory budget, let it stay stale
+    if (!proxycache.exists(key)) return;
+    long lifetime = notModified.freshness_lifetime();
+    if (lifetime == 0) lifetime = page->lifetime;
+    proxycache.put(key, std::make_shared<const cache_entry>(cache_entry{
+        page->text, page->etag, io::timer::timer_service::clock_t::now(),
+        notModified.initial_age(time(nullptr)), lifetime}));
+}
+void proxy_server::storePage(const std::string &key, std::string text, const std::string &etag, long lifetime,
+                             long initialAge)
+{
+    if (diskCache && text.size() > diskThreshold) {
+        proxycache.remove(key);
+        if (!diskCache->put(key, etag, text.data(), text.size())) diskCache->remove(key);
+        return;
+    }
+    if (diskCache) diskCache->remove(key); // superseded by the fresher copy
+    if (text.capacity() - text.size() > text.size() / 8) text.shrink_to_fit(); // the budget counts capacity
+    proxycache.put(key, std::make_shared<const cache_entry>(cache_entry{
+        outstring(std::move(text)), etag, io::timer::timer_service::clock_t::now(), initialAge, lifetime}));
+}
+void proxy_server::dropPage(const std::string &key)
+{
+    LOG("Invalidated: %s", key.c_str());
+    proxycache.remove(key);
+    if (diskCache) diskCache->remove(key);
+}
+void proxy_server::resolve(const std::string &host)
+{
+    if (asyncResolver) {
+        asyncResolver->resolve(host);
+    }
+    else {
+        domainResolver.sendDomainForResolve(host);
+    }
+}
 void proxy_server::outbound::try_to_cache()
 {
-    if (resp && resp->is_cacheable() && !cacheHit) {
-        std::string temp = host + URI;
-        LOG("Cached: %s (%s)", temp.c_str(), resp->get_header("ETag").c_str());
-        parent->proxycache.put(temp, response(*resp));
+    if (resp && resp->is_cacheable() && !cacheHit && toGet) {
+        std::string etag = resp->get_header("ETag"); // headers point into the text released below
+        LOG("Cached: %s (%s)", key.c_str(), etag.c_str());
+        long lifetime = resp->freshness_lifetime(), age = resp->initial_age(time(nullptr));
+        parent->storePage(key, resp->release_text(), etag, lifetime, age);
+        resp.reset(); // its text is gone
     }
 
 }
+// Keeps resp's text buffer for the next response, unless a large body grew it
+void proxy_server::outbound::dropResponse()
+{
+    std::string text = resp->release_text();
+    if (text.capacity() <= arena::maxRetained) spareText = std::move(text);
+    resp.reset();
+}
 void proxy_server::outbound::onReadDiscard()
 {
     assert(socket);
-    size_t n = socket->get_available_bytes();
-    LOG("Bytes discarded: %lu ", n);
-    char buf[n + 1];
-    ssize_t res = socket->read_over_connection(buf, n);
-    if (res == -1) {
-        throw_error(errno, "NestedRead()");
+    std::shared_ptr<char> buffer = parent->buffers.acquire();
+    for (size_t round = 0; round < proxy_server::readRounds; round++) {
+        ssize_t res = socket->read_over_connection(buffer.get(), buffer_pool::bufferSize);
+        if (res <= 0) return; // EOF is noticed through RDHUP
+        LOG("Bytes discarded: %ld ", res);
+        proxy_metrics::add(parent->stats->originBytes, res);
     }
 }
 void proxy_server::outbound::askMore()
 {
-    assert(socket);
-    if (!cacheHit) {
-        socket->setOn_read(std::bind(&outbound::onRead, this));
+    if (tunnel) {
+        if (!originEOF) socket->setOn_read([this] { onTunnelRead(); });
+    }
+    else if (socket && !cacheHit) {
+        if (relaying) socket->setOn_read([this] { onRelay(); });
+        else socket->setOn_read([this] { onRead(); });
     }
 }
 void proxy_server::inbound::trySend(outstring &out)
 {
-    out += socket.write_over_connection(out.get(), out.size());
-    if (!out) {
-        output.push(out);
-        socket.setOn_write(std::bind(&inbound::handleWrite, this));
+    output.push(out); // behind anything still queued
+    output.flush(socket);
+    if (!output.empty()) {
+        socket.setOn_write([this] { handleWrite(); });
+    }
+}
+void proxy_server::inbound::flushRelay()
+{
+    timer.recharge(proxy_server::idleTimeout);
+    if (output.empty()) relay.drain(socket.getFd());
+    if (!output.empty() || !relay.empty()) {
+        socket.setOn_write([this] { handleWrite(); });
+    }
+}
+void proxy_server::inbound::startTunnel()
+{
+    timer.recharge(proxy_server::tunnelIdleTimeout);
+    output.push(outstring(std::string("HTTP/1.1 200 Connection established\r\n\r\n")));
+    if (!tunnelPrefix.empty()) assigned->output.push(outstring(std::move(tunnelPrefix)));
+    assigned->flushUpload(); // also starts reading the client
+    flushTunnel();
+}
+// Client to origin
+void proxy_server::inbound::onTunnelRead()
+{
+    outbound &up = *assigned;
+    ssize_t res = up.upload.fill(socket.getFd(), proxy_server::relayThreshold);
+    if (res == 0) {
+        LOG("(%d):Client closed its side of the tunnel", socket.getFd().get_raw());
+        up.clientEOF = true;
+        socket.peer_closed();
+        socket.setOn_read(connection::callback());
+    }
+    else if (res > 0) {
+        proxy_metrics::add(parent->stats->clientBytes, res);
+        timer.recharge(proxy_server::tunnelIdleTimeout);
+    }
+    up.flushUpload(); // may close the tunnel, and destroy this
+}
+// Origin to client: the 200 line first, then the pipe
+void proxy_server::inbound::flushTunnel()
+{
+    outbound &up = *assigned;
+    if (!output.empty()) output.flush(socket);
+    if (output.empty() && !relay.empty()) relay.drain(socket.getFd());
+    if (!output.empty() || !relay.empty()) {
+        socket.setOn_write([this] { handleWrite(); });
+        up.socket->setOn_read(connection::callback()); // the pipe has no room, resumed from here
+        return;
+    }
+    socket.setOn_write(connection::callback());
+    if (!up.originEOF) {
+        up.askMore();
+        return;
     }
-    else if (assigned) assigned->askMore();
+    if (!up.clientShut) {
+        up.clientShut = true;
+        socket.shutdown_write();
+    }
+    up.closeTunnelIfDone();
+}
+// The pipe and then the origin's socket are read out into output, in order:
+// the socket is about to go and the pipe is only drained after output
+void proxy_server::inbound::takeTunnelTail(connection &origin)
+{
+    try {
+        for (;;) {
+            std::shared_ptr<char> buffer = parent->buffers.acquire();
+            size_t res = relay.take(buffer.get(), buffer_pool::bufferSize);
+            if (res == 0) break;
+            output.push(outstring(buffer, buffer.get(), res));
+        }
+        for (;;) {
+            std::shared_ptr<char> buffer = parent->buffers.acquire();
+            ssize_t res = origin.read_over_connection(buffer.get(), buffer_pool::bufferSize);
+            if (res <= 0) break;
+            output.push(outstring(buffer, buffer.get(), res));
+        }
+    }
+    catch (std::exception &e) {
+        LOG("(%d):Tunnel tail lost: %s", socket.getFd().get_raw(), e.what());
+    }
+}
+size_t proxy_server::inbound::buffered() const
+{
+    return output.bytes() + relay.size();
+}
+// Spliced bytes count as over the mark: reads only resume on an empty pipe
+bool proxy_server::inbound::belowLowWater() const
+{
+    return relay.empty() && output.bytes() <= parent->lowWater;
 }
 proxy_server::outbound::~outbound()
 {
     try_to_cache();
 }
-const std::string proxy_server::outbound::getHost()
+const std::string &proxy_server::outbound::getHost() const
 {
     return host;
 }
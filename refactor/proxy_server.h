@@ -14,13 +14,26 @@
 #include "acceptor.h"
 #include "events.h"
 #include "outstring.h"
+#include "output_chain.h"
+#include "fifo.h"
+#include "buffer_pool.h"
 #include "signal_fd.h"
 #include "resolver.h"
+#include "splice_pipe.h"
+#include "upstream_pool.h"
+#include "dns_client.h"
+#include "lrucache.h"
+#include "dns_cache.h"
+#include "disk_cache.h"
+#include "metrics.h"
+#include "admin_server.h"
 #include <map>
 #include <regex>
 #include <queue>
 #include <mutex>
-#include <boost/signals2/connection.hpp>
+#include <list>
+#include <vector>
+#include <unordered_map>
 
 class proxy_server
 {
@@ -38,24 +51,63 @@ class proxy_server
     std::chrono::seconds(600)
 #endif
     ;
+    constexpr static const io::timer::timer_service::clock_t::duration upstreamIdleTimeout =
+#ifdef DEBUG
+        std::chrono::seconds(5)
+#else
+    std::chrono::seconds(60)
+#endif
+    ;
+    // Bytes of responses kept in proxycache, keys included
+    constexpr static const size_t cacheBudget =
+#ifdef DEBUG
+        32 * 1024 * 1024
+#else
+    256 * 1024 * 1024
+#endif
+    ;
+    // Slab file size of the disk tier, also the largest object it takes
+    constexpr static const size_t diskSlabSize = 64 * 1024 * 1024;
+    // With a disk tier, larger responses skip memory and go straight to disk
+    constexpr static const size_t diskThreshold = 1024 * 1024;
+    constexpr static const size_t upstreamMaxIdle = 512;
+    constexpr static const size_t upstreamMaxPerHost = 16;
+    constexpr static const io::timer::timer_service::clock_t::duration tunnelIdleTimeout =
+#ifdef DEBUG
+        std::chrono::seconds(30)
+#else
+    std::chrono::seconds(300)
+#endif
+    ;
+    // Reads per readiness event, so one busy socket can't starve the rest
+    constexpr static const size_t readRounds = 4;
+    constexpr static const size_t idleBuffers = 256;
+    // Requests parsed ahead of the one being served before client reads pause
+    constexpr static const size_t pipelineDepth = 16;
+    // Non-cacheable bodies at least this large are relayed with splice()
+    constexpr static const size_t relayThreshold = 64 * 1024;
     struct inbound;
     struct outbound;
-    struct FirstFound
+    // A stored response. Immutable and shared: eviction only drops the cache's
+    // reference, clients still sending it keep theirs.
+    struct cache_entry
     {
-        typedef bool result_type;
-        template<typename InputIterator>
-        result_type operator()(InputIterator aFirstObserver, InputIterator aLastObserver) const
-        {
-            result_type val = false;
-            for (; aFirstObserver != aLastObserver && !val; ++aFirstObserver) {
-                val = *aFirstObserver;
-            }
-            return val;
-        }
+        outstring text;
+        std::string etag;
+        io::timer::timer_service::clock_t::time_point storedAt;
+        long initialAge; // seconds, when stored
+        long lifetime; // seconds of freshness, 0 to always revalidate
+    };
+    typedef std::shared_ptr<const cache_entry> cache_ref;
+    struct page_cost
+    {
+        size_t operator()(const std::string &key, const cache_ref &page) const
+        { return key.size() + sizeof(cache_entry) + page->text.length + page->etag.capacity(); }
     };
     struct inbound
     {
         friend struct outbound;
+        friend class proxy_server;
 
         inbound(proxy_server *parent);
         ~inbound();
@@ -63,18 +115,65 @@ class proxy_server
         void handleWrite();
         void sendBadRequest();
         void sendNotFound();
-        bool onResolve(resolver::resolverNode);
+        void onResolve(const resolver::resolverNode &);
 
     private:
+        void parse(const char *, size_t);
+        std::shared_ptr<request> newRequest(std::string text);
+        void startNext();
+        void dispatch();
+        void headersParsed();
+        void exchangeDone();
+        void closeAfterFlush();
+        void abortUpload();
+        bool bodyPending() const;
+        size_t uploadBacklog() const;
+        void sendCached(const cache_ref &, long age);
+        void finishRequest();
+        std::string spareText();
+        void keepSpare(std::string text);
+        void startTunnel();
+        void onTunnelRead();
+        void flushTunnel();
+        void takeTunnelTail(connection &origin);
         void trySend(outstring &);
+        void flushRelay();
+        size_t buffered() const;
+        bool belowLowWater() const;
         void wakeUp();
         proxy_server *parent;
         connection socket;
-        std::shared_ptr<request> requ;
-        boost::signals2::connection resolverConnection;
+        // Every request parses into an arena of its own: pipelined ones arrive
+        // while earlier ones are answered, one arena would never get a reset
+        struct request_arena
+        {
+            std::unique_ptr<arena> memory;
+            std::weak_ptr<request> user; // dropped before memory, its control block lives there
+        };
+        std::vector<request_arena> arenas; // reused once their request is gone
+        std::vector<std::string> spares; // text buffers of answered requests, reused by the next ones
+        std::shared_ptr<request> incoming; // still being received
+        bool streamed = false; // incoming is queued already, its body goes upstream as it arrives
+        fifo<std::shared_ptr<request>> pipeline; // received, answered in this order
+        std::shared_ptr<request> requ; // being answered
+        std::string host; // requ's, the buffer is reused by the next ones
+        bool busy = false; // requ's response is not complete yet
+        bool dispatching = false;
+        bool keepAlive = true;
+        bool stopped = false; // after a request that failed to parse or a CONNECT, nothing is read as HTTP
+        std::string tunnelPrefix; // sent after the CONNECT, before the tunnel was open
+        bool closing = false; // disconnect once the output is sent
+        bool uploadPaused = false; // the origin is behind on the body, until it drains to the low mark
+        bool waiting = false;
+        std::list<inbound *>::iterator waitPosition;
         std::shared_ptr<outbound> assigned;
         io::timer::timer_element timer;
-        std::queue<outstring> output;
+        output_chain output;
+        splice_pipe relay; // spliced response bytes, always sent after output
+        // for proxy_metrics; requestStart is unset until the next request's first byte
+        histogram::clock_t::time_point requestStart;
+        histogram::clock_t::time_point dispatchedAt;
+        histogram::clock_t::time_point resolveStart;
     };
     struct outbound
     {
@@ -82,44 +181,113 @@ class proxy_server
         ~outbound();
         void handleWrite();
         void onRead();
+        void onChunk(outstring);
         void onReadDiscard();
-        const std::string getHost();
+        void onRelay();
+        void onDisconnect();
+        void sendBody();
+        void openTunnel(ipv4_endpoint endpoint);
+        void onTunnelConnected();
+        void onTunnelRead();
+        void flushUpload();
+        void closeTunnelIfDone();
+        const std::string &getHost() const;
     private:
         void try_to_cache();
-        void perform_connection(ipv4_endpoint endpoint);
+        void finishResponse();
+        void dropResponse();
+        void finishAtClose();
+        bool startRelay();
+        void perform_connection(ipv4_endpoint endpoint, bool pooled = true);
         void form_request();
         void askMore();
         friend struct inbound;
         std::unique_ptr<connection> socket;
+        ipv4_endpoint endpoint;
         io::timer::timer_element timer;
         inbound *assigned;
+        arena memory; // holds resp and its parse state, reset for every response
         std::shared_ptr<response> resp;
+        std::string spareText; // the last response's text buffer, the next one is read into it
         std::string host;
-        std::string URI;
-        std::queue<outstring> output;
+        std::string key; // host and URI, the cache key
+        output_chain output;
         proxy_server *parent;
+        cache_ref cached; // the entry being revalidated
+        bool inFlight = false; // a request was sent and its response isn't complete
+        bool uploading = false; // the request's body is still arriving from the client
+        bool streaming = false; // resp only frames a body that isn't kept
         bool cacheHit = false;
         bool validateRequest = false;
+        bool toHead = false; // the response has no body whatever its headers say
+        bool toGet = false; // only GET responses are stored and revalidated
+        bool relaying = false;
+        size_t relayLeft = 0;
+        // CONNECT: bytes go both ways through pipes, each side closes on its own
+        bool tunnel = false; // set once connected
+        bool clientEOF = false;
+        bool originEOF = false;
+        bool originShut = false; // the client's EOF has been passed on
+        bool clientShut = false;
+        splice_pipe upload; // client to origin, sent after output
+        bool connecting = false; // a new connection, not yet writable
+        bool answered = false; // the current response's first byte arrived
+        histogram::clock_t::time_point connectStart;
+        histogram::clock_t::time_point sentAt;
     };
 public:
+    // Response bytes queued for one client before upstream reads pause, and the
+    // level the queue must drain to before they resume
+    constexpr static const size_t highWatermark = 256 * 1024;
+    constexpr static const size_t lowWatermark = 64 * 1024;
     proxy_server(io::io_service &ep, ipv4_endpoint const &local_endpoint);
     proxy_server(io::io_service &ep, ipv4_endpoint const &local_endpoint, size_t);
     ~proxy_server();
     ipv4_endpoint local_endpoint() const;
     resolver &getResolver();
+    void useNameserver(ipv4_endpoint const &);
+    void setCacheBudget(size_t bytes);
+    void setWatermarks(size_t low, size_t high);
+    void shareDnsCache(std::shared_ptr<dns_cache>);
+    void shareMetrics(std::shared_ptr<proxy_metrics>);
+    void useAdminPort(ipv4_endpoint const &);
+    void useDiskCache(const std::string &directory, size_t bytes);
+    void shutdown();
+    events stopEvent;
     events resolveEvent;
-    signal_fd sigfd;
     io::io_service *ios;
 private:
     void on_new_connection();
+    void resolve(const std::string &host);
+    void waitResolve(inbound *, const std::string &host);
+    void onResolved(const resolver::resolverNode &);
+    void answer(inbound *, const resolver::resolverNode &);
+    cache_ref findPage(const std::string &key);
+    void storePage(const std::string &key, std::string text, const std::string &etag, long lifetime, long initialAge);
+    void refreshPage(const std::string &key, const cache_ref &, const response &notModified);
+    void dropPage(const std::string &key);
+    bool serveFresh(inbound *);
     friend struct inbound;
     friend struct outbound;
     acceptor ss;
     resolver domainResolver;
+    std::unique_ptr<dns_client> asyncResolver; // replaces the resolver threads when set
     bool stop = false;
+    size_t idleTicks = 0;
+    size_t lowWater = lowWatermark;
+    size_t highWater = highWatermark;
+    upstream_pool upstreams;
+    buffer_pool buffers; // declared before the connections whose queues hold its buffers
     std::map<inbound *, std::unique_ptr<inbound>> connections;
-    cache::lru_cache<std::string, response> proxycache;
-    boost::signals2::signal<bool(resolver::resolverNode), FirstFound> distribution;
+    cache::lru_cache<std::string, cache_ref, page_cost> proxycache;
+    std::shared_ptr<dns_cache> dnsCache; // possibly shared with other reactors
+    std::shared_ptr<proxy_metrics> stats; // likewise
+    std::unique_ptr<admin_server> admin; // serves stats when set
+    std::unique_ptr<disk_cache> diskCache; // takes what proxycache evicts, when set
+    // Inbounds waiting for a name, in arrival order. An entry exists exactly while
+    // one resolution of that name is in flight.
+    std::unordered_map<std::string, std::list<inbound *>> waiters;
+    std::string lookupKey; // serveFresh()'s, its buffer reused for every request
 };
 
 
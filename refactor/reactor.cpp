@@ -0,0 +1,44 @@
+#include "reactor.h"
+#include "debug.h"
+
+reactor::reactor(ipv4_endpoint const &endpoint, reactor_options const &options)
+    : ios(1000, nullptr, options.batch), server(ios, endpoint, options.resolvers)
+{
+    if (options.nameserver) server.useNameserver(options.nameserver.get());
+    if (options.cacheBudget) server.setCacheBudget(options.cacheBudget.get());
+    server.setWatermarks(options.lowWatermark, options.highWatermark);
+    if (options.dnsCache) server.shareDnsCache(options.dnsCache);
+    if (options.metrics) server.shareMetrics(options.metrics);
+    if (options.admin) server.useAdminPort(options.admin.get());
+    if (options.diskCache) server.useDiskCache(options.diskCache.get(), options.diskBudget);
+}
+void reactor::start()
+{
+    worker = boost::thread(boost::bind(&reactor::run, this));
+}
+void reactor::run()
+{
+    try {
+        ios.run();
+    }
+    catch (std::exception &e) {
+        LOG("Reactor stopped: %s", e.what());
+    }
+}
+void reactor::shutdown()
+{
+    server.shutdown();
+}
+void reactor::join()
+{
+    if (worker.joinable()) worker.join();
+}
+ipv4_endpoint reactor::local_endpoint() const
+{
+    return server.local_endpoint();
+}
+reactor::~reactor()
+{
+    shutdown();
+    join();
+}
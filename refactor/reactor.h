@@ -0,0 +1,45 @@
+#ifndef POLL_EVENT_REACTOR_H
+#define POLL_EVENT_REACTOR_H
+
+#include <boost/thread.hpp>
+#include <boost/optional.hpp>
+#include "io_service.h"
+#include "proxy_server.h"
+
+// One event loop pinned to one thread. Every reactor binds its own listening
+// socket to the same endpoint (SO_REUSEPORT) and the kernel balances accepts.
+// Everything a proxy_server owns (connections, timers, resolver, proxycache)
+// is touched only from the reactor thread; the only cross-thread entry points
+// are shutdown() and the dns_cache, which is thread-safe.
+struct reactor_options
+{
+    size_t resolvers = 10;
+    size_t batch = DEFAULT_BATCH;
+    boost::optional<ipv4_endpoint> nameserver; // asynchronous DNS instead of resolver threads
+    boost::optional<size_t> cacheBudget; // bytes of page cache for this reactor
+    std::shared_ptr<dns_cache> dnsCache; // shared between reactors when set
+    std::shared_ptr<proxy_metrics> metrics; // likewise
+    boost::optional<ipv4_endpoint> admin; // metrics endpoint, every reactor binds it (SO_REUSEPORT)
+    boost::optional<std::string> diskCache; // directory of this reactor's disk tier
+    size_t diskBudget = 1024 * 1024 * 1024;
+    size_t lowWatermark = proxy_server::lowWatermark; // per client, see proxy_server
+    size_t highWatermark = proxy_server::highWatermark;
+};
+class reactor
+{
+public:
+    reactor(ipv4_endpoint const &, reactor_options const &);
+    ~reactor();
+    void start();
+    void shutdown();
+    void join();
+    ipv4_endpoint local_endpoint() const;
+private:
+    void run();
+    io::io_service ios;
+    proxy_server server;
+    boost::thread worker;
+};
+
+
+#endif //POLL_EVENT_REACTOR_H
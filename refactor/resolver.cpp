@@ -8,26 +8,21 @@
 #include "resolver.h"
 #include "debug.h"
 #include "utils.h"
+constexpr const uint32_t resolver::defaultTTL;
+constexpr const uint32_t resolver::negativeTTL;
 void resolver::sendDomainForResolve(std::string string)
 {
-//    if (dnsCache.exists(string)) {
-//        LOG("DNS hit: %s(%s)", string.c_str(), dnsCache.get(string).to_string().c_str());
-//        resolverFinished.push({string, dnsCache.get(string)});
-//        finisher->add();
-//    }
-//    else {
+    // cache hits are answered by the caller, see dns_cache
     std::unique_lock<std::mutex> resolveLock(resolveMutex);
     domains.push(string);
     newTask.notify_one();
-//    }
-    return;
 }
 resolver::resolver(events &events1, size_t t)
-    : finisher(&events1), dnsCache(500)
+    : finisher(&events1)
 {
     LOG("Starting with %lu workers",t);
     try {
-        for (auto i = 0; i < t; i++) resolvers.create_thread(boost::bind(&resolver::worker, this));
+        for (size_t i = 0; i < t; i++) resolvers.create_thread(boost::bind(&resolver::worker, this));
     }
     catch (std::exception &e) {
         stopWorkers();
@@ -48,15 +43,7 @@ void resolver::worker()
             std::string port, name, input;
             input = domains.front();
             domains.pop();
-            std::unique_lock<std::mutex> distributeLock(distributeMutex);
-            bool hit = dnsCache.exists(input);
-            distributeLock.unlock();
-            if (hit) {
-                LOG("DNS hit: %s", input.c_str());
-                sendToDistribution({input, dnsCache.get(input)});
-                continue;
-            }
-            // TODO: check if this domain is already cached. DONE
+            resolveLock.unlock();
             name = input;
             port = "80";
             auto it = input.find(':');
@@ -74,7 +61,7 @@ void resolver::worker()
                 LOG("Resolve failed:%s(%s:%s)(%s). Signal proceed.",
                     input.data(), name.data(), port.data(),
                     gai_strerror(res));
-                sendToDistribution({input});
+                sendToDistribution({input, res == EAI_NONAME ? negativeTTL : 0});
                 continue;
             }
             char buffer[INET6_ADDRSTRLEN];
@@ -95,12 +82,10 @@ void resolver::worker()
             uint16_t portShort;
             if (!str_to_uint16(port.c_str(), &portShort)) {
                 LOG("Invalid port(%s). Signal proceed", port.c_str());
-                sendToDistribution({input});
+                sendToDistribution({input, negativeTTL});
             }
             else {
                 sendToDistribution({input, {portShort, ipv4_address(std::string(buffer))}});
-                // TODO: insert result into dnsCache and remove cacheDomain from public interface DONE
-                // TODO: we should protect accesses to dnsCache with distributeMutex DONE
             }
         }
     }
@@ -111,13 +96,8 @@ resolver::~resolver()
 }
 void resolver::sendToDistribution(const resolverNode &n)
 {
-    std::unique_lock<std::mutex> distribution(distributeMutex);
-    if(n.resolvedHost && !dnsCache.exists(n.host)) {
-        LOG("Put in cache: %s",n.host.c_str());
-        dnsCache.put(n.host,n.resolvedHost.get());
-    }
-    resolverFinished.push(n);
-    finisher->add();
+    // the loop hasn't drained the results before this one yet, it will see it too
+    if (resolverFinished.push(n)) finisher->add();
 }
 void resolver::stopWorkers()
 {
@@ -127,22 +107,14 @@ void resolver::stopWorkers()
     newTask.notify_all();
     resolvers.join_all();
 }
-resolver::resolverNode resolver::getFirst()
+size_t resolver::drain(const std::function<void(const resolverNode &)> &consume)
 {
-    assert(!resolverFinished.empty());
-    std::unique_lock<std::mutex> distributionLock(distributeMutex);
-    auto result = resolverFinished.front();
-    resolverFinished.pop();
-    return result;
+    return resolverFinished.drain(consume);
 }
 void resolver::resize(size_t t)
 {
     stopWorkers();
     destroyThreads = false;
-    for (auto i = 0; i < t; i++) resolvers.create_thread(boost::bind(&resolver::worker, this));
+    for (size_t i = 0; i < t; i++) resolvers.create_thread(boost::bind(&resolver::worker, this));
     LOG("Resized to %lu workers",t);
 }
-size_t resolver::cacheSize() const
-{
-    return dnsCache.size();
-}
@@ -7,10 +7,8 @@
 
 
 #include "address.h"
-#include "lrucache.h"
 #include "events.h"
-#include <boost/signals2.hpp>
-#include <boost/lockfree/queue.hpp>
+#include "mpsc_queue.h"
 #include <boost/optional.hpp>
 #include <boost/thread.hpp>
 #include <mutex>
@@ -22,17 +20,22 @@ class resolver
 public:
     struct resolverNode
     {
-        resolverNode(std::string _host, ipv4_endpoint to): host(_host), resolvedHost(to){} //OK
-        resolverNode(std::string _host):host(_host){} //Resolver failed
+        resolverNode(std::string _host, ipv4_endpoint to, uint32_t _ttl = defaultTTL)
+            : host(_host), resolvedHost(to), ttl(_ttl){} //OK
+        resolverNode(std::string _host, uint32_t _ttl = 0):host(_host), ttl(_ttl){} //Resolver failed
         std::string host;
         //ipv4_endpoint resolvedHost; // TODO: replace with boost::optional<ipv4_endpoint> DONE
         boost::optional<ipv4_endpoint> resolvedHost;
+        uint32_t ttl; // seconds the answer may be cached, 0 for not at all
     };
-    typedef std::queue<resolverNode> resolveQueue_t;
-    resolver(events &, size_t);
-    resolverNode getFirst();
+    // getaddrinfo() doesn't report record TTLs
+    constexpr static const uint32_t defaultTTL = 60;
+    constexpr static const uint32_t negativeTTL = 5;
+    // `finisher` must not be in semaphore mode: one wakeup stands for any number of results
+    resolver(events &finisher, size_t);
+    // Passes every finished lookup to `consume`, on the loop thread
+    size_t drain(const std::function<void(const resolverNode &)> &consume);
     void sendDomainForResolve(std::string);
-    size_t cacheSize() const;
     void resize(size_t);
     ~resolver();
 private:
@@ -45,9 +48,7 @@ private:
     std::mutex resolveMutex;
     boost::thread_group resolvers;
     bool destroyThreads = false; // TODO: protect with mutex. DONE
-    std::mutex distributeMutex;
-    resolveQueue_t resolverFinished;
-    cache::lru_cache<std::string,ipv4_endpoint> dnsCache;
+    mpsc_queue<resolverNode> resolverFinished;
     events *finisher;
 };
 
@@ -58,7 +58,7 @@ void signal_fd::modifymask(std::vector<signal> &vector)
 signal_fd::signal_fd(io::io_service &service,
                      signal_fd::callback callback,
                      std::vector<signal_fd::signal> vector)
-    : on_ready(std::move(callback)),fd(createfd(vector)),
+    : fd(createfd(vector)), on_ready(std::move(callback)),
       ioEntry(service,fd,EPOLLIN,[this](uint32_t)
       {
 
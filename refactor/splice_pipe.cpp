@@ -0,0 +1,64 @@
+#include <algorithm>
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include "splice_pipe.h"
+#include "epoll_error.h"
+#include "debug.h"
+
+splice_pipe::splice_pipe()
+{
+}
+void splice_pipe::open()
+{
+    int fds[2];
+    if (pipe2(fds, O_NONBLOCK | O_CLOEXEC) == -1) {
+        throw_error(errno, "pipe2()");
+    }
+    readEnd.reset(fds[0]);
+    writeEnd.reset(fds[1]);
+}
+ssize_t splice_pipe::fill(const handle &from, size_t max)
+{
+    if (writeEnd.get_raw() == -1) open();
+    ssize_t res = splice(from.get_raw(), nullptr, writeEnd.get_raw(), nullptr, max,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (res == -1) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK) return -1;
+        throw_error(errno, "splice(in)");
+    }
+    pending += static_cast<size_t>(res);
+    return res;
+}
+size_t splice_pipe::drain(const handle &to)
+{
+    if (pending == 0) return 0;
+    ssize_t res = splice(readEnd.get_raw(), nullptr, to.get_raw(), nullptr, pending,
+                         SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (res == -1) {
+        int err = errno;
+        if (err == EAGAIN || err == ECONNRESET) return 0;
+        throw_error(err, "splice(out)");
+    }
+    pending -= static_cast<size_t>(res);
+    return static_cast<size_t>(res);
+}
+size_t splice_pipe::take(void *data, size_t size)
+{
+    if (pending == 0) return 0;
+    ssize_t res = read(readEnd.get_raw(), data, std::min(size, pending));
+    if (res == -1) {
+        if (errno == EAGAIN) return 0;
+        throw_error(errno, "read(pipe)");
+    }
+    pending -= static_cast<size_t>(res);
+    return static_cast<size_t>(res);
+}
+bool splice_pipe::empty() const
+{
+    return pending == 0;
+}
+size_t splice_pipe::size() const
+{
+    return pending;
+}
@@ -0,0 +1,28 @@
+#ifndef POLL_EVENT_SPLICE_PIPE_H
+#define POLL_EVENT_SPLICE_PIPE_H
+
+#include <cstddef>
+#include <sys/types.h>
+#include "handle.h"
+
+// Kernel-side buffer for zero-copy relaying: bytes are spliced from one socket
+// into the pipe and from the pipe into another socket without reaching userspace.
+// The pipe itself is created on first use.
+class splice_pipe
+{
+public:
+    splice_pipe();
+    ssize_t fill(const handle &from, size_t max); // -1 on EAGAIN, 0 on EOF
+    size_t drain(const handle &to);
+    size_t take(void *data, size_t size); // reads pending bytes out to userspace
+    bool empty() const;
+    size_t size() const;
+private:
+    void open();
+    handle readEnd;
+    handle writeEnd;
+    size_t pending = 0;
+};
+
+
+#endif //POLL_EVENT_SPLICE_PIPE_H
@@ -4,37 +4,131 @@
 
 #include "timer.h"
 #include "debug.h"
+
+const size_t io::timer::timer_service::WHEEL_BITS;
+const size_t io::timer::timer_service::WHEEL_SLOTS;
+const size_t io::timer::timer_service::WHEEL_LEVELS;
+
 io::timer::timer_service::timer_service()
+    : origin(clock_t::now()), wheel()
 {
 
+}
+io::timer::timer_service::tick_t io::timer::timer_service::to_tick(clock_t::time_point point, bool ceil) const
+{
+    if (point <= origin) return 0;
+    auto since = point - origin;
+    auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(since);
+    tick_t result = static_cast<tick_t>(ms.count());
+    if (ceil && ms < since) result++;
+    return result;
 }
 void io::timer::timer_service::add(io::timer::timer_element *element)
 {
-    queue.insert({element->wake,element});
+    if (element->pprev) remove(element);
+    element->expires = to_tick(element->wake, true);
+    if (element->expires <= current) element->expires = current + 1;
+    link(element);
+    total++;
 }
 void io::timer::timer_service::remove(io::timer::timer_element *element)
 {
-    auto i = queue.find(element->wake);
-    if(i!=queue.end())
-        queue.erase(i);
+    if (!element->pprev) return;
+    unlink(element);
+    total--;
+}
+void io::timer::timer_service::link(io::timer::timer_element *element)
+{
+    tick_t delta = element->expires - current;
+    size_t lvl = 0;
+    while (lvl + 1 < WHEEL_LEVELS && delta >= (tick_t(1) << (WHEEL_BITS * (lvl + 1)))) lvl++;
+    tick_t horizon = tick_t(1) << (WHEEL_BITS * WHEEL_LEVELS);
+    if (delta >= horizon) element->expires = current + horizon - 1;
+
+    size_t idx = (element->expires >> (WHEEL_BITS * lvl)) & (WHEEL_SLOTS - 1);
+    level &l = wheel[lvl];
+    element->level = static_cast<uint8_t>(lvl);
+    element->slot = static_cast<uint8_t>(idx);
+    element->next = l.slots[idx];
+    element->pprev = &l.slots[idx];
+    if (element->next) element->next->pprev = &element->next;
+    l.slots[idx] = element;
+    l.occupied[idx / 64] |= uint64_t(1) << (idx % 64);
+    l.count++;
+}
+void io::timer::timer_service::unlink(io::timer::timer_element *element)
+{
+    level &l = wheel[element->level];
+    *element->pprev = element->next;
+    if (element->next) element->next->pprev = element->pprev;
+    if (!l.slots[element->slot]) l.occupied[element->slot / 64] &= ~(uint64_t(1) << (element->slot % 64));
+    l.count--;
+    element->next = nullptr;
+    element->pprev = nullptr;
 }
 bool io::timer::timer_service::empty() const
 {
-    return queue.empty();
+    return total == 0;
+}
+size_t io::timer::timer_service::size() const
+{
+    return total;
+}
+size_t io::timer::timer_service::first_occupied(const level &l, size_t from) const
+{
+    for (size_t n = 0; n < WHEEL_SLOTS;) {
+        size_t idx = (from + n) & (WHEEL_SLOTS - 1);
+        uint64_t word = l.occupied[idx / 64] >> (idx % 64);
+        if (word) {
+            size_t found = n + __builtin_ctzll(word);
+            return found < WHEEL_SLOTS ? found : WHEEL_SLOTS;
+        }
+        n += 64 - idx % 64;
+    }
+    return WHEEL_SLOTS;
 }
 io::timer::timer_service::clock_t::time_point io::timer::timer_service::top() const
 {
-    return queue.begin()->first;
+    // Exact for level 0. For higher levels this is the tick at which the first
+    // occupied slot is cascaded, a lower bound of its nearest expiration. Every
+    // level counts: a level 2 slot may be cascaded before the next level 1 one.
+    tick_t tick = current + 1 + WHEEL_SLOTS;
+    bool found = false;
+    for (size_t lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+        tick_t base = current >> (WHEEL_BITS * lvl);
+        size_t distance = first_occupied(wheel[lvl], (base + 1) & (WHEEL_SLOTS - 1));
+        if (distance == WHEEL_SLOTS) continue;
+        tick_t next = (base + 1 + distance) << (WHEEL_BITS * lvl);
+        if (!found || next < tick) tick = next;
+        found = true;
+    }
+    return origin + std::chrono::milliseconds(tick);
 }
-void io::timer::timer_service::process(clock_t::time_point point)
+void io::timer::timer_service::cascade(size_t lvl)
+{
+    size_t idx = (current >> (WHEEL_BITS * lvl)) & (WHEEL_SLOTS - 1);
+    level &l = wheel[lvl];
+    timer_element *list = l.slots[idx];
+    l.slots[idx] = nullptr;
+    l.occupied[idx / 64] &= ~(uint64_t(1) << (idx % 64));
+    while (list) {
+        timer_element *element = list;
+        list = list->next;
+        l.count--;
+        link(element);
+    }
+    if (idx == 0 && lvl + 1 < WHEEL_LEVELS) cascade(lvl + 1);
+}
+void io::timer::timer_service::expire()
 {
-    for(;;){
-        if(empty()) break;
-        if(queue.begin()->first > point) break;
-        auto nearest = queue.begin();
-        nearest->second->parent = nullptr;
+    timer_element *&slot = wheel[0].slots[current & (WHEEL_SLOTS - 1)];
+    while (slot) {
+        timer_element *nearest = slot;
+        remove(nearest);
+        // the callback may destroy its own element
+        timer_element::callback_t callback = nearest->on_wake;
         try{
-            nearest->second->on_wake();
+            callback();
         }
         catch(std::exception &e){
             LOG("Couldn't process timer: %s",e.what());
@@ -42,7 +136,28 @@ void io::timer::timer_service::process(clock_t::time_point point)
         catch(...){
             INFO("Couldn't process timer due to an unknown error");
         }
-        queue.erase(nearest);
+    }
+}
+void io::timer::timer_service::process(clock_t::time_point point)
+{
+    tick_t target = to_tick(point, false);
+    while (current < target) {
+        if (total == 0) {
+            current = target;
+            break;
+        }
+        if (wheel[0].count == 0) {
+            // nothing can fire before the next cascade: skip to it
+            tick_t boundary = current | (WHEEL_SLOTS - 1);
+            if (boundary >= target) {
+                current = target;
+                break;
+            }
+            current = boundary;
+        }
+        current++;
+        if ((current & (WHEEL_SLOTS - 1)) == 0) cascade(1);
+        expire();
     }
 }
 io::timer::timer_element::timer_element():parent(nullptr)
@@ -64,6 +179,27 @@ io::timer::timer_element::timer_element(io::timer::timer_service &service,
 {
     parent->add(this);
 }
+io::timer::timer_element::timer_element(io::timer::timer_element &&other)
+    :parent(other.parent),wake(other.wake),on_wake(std::move(other.on_wake))
+{
+    if (other.pprev) {
+        parent->remove(&other);
+        parent->add(this);
+    }
+}
+io::timer::timer_element &io::timer::timer_element::operator=(io::timer::timer_element &&other)
+{
+    if (this == &other) return *this;
+    if (parent) parent->remove(this);
+    parent = other.parent;
+    wake = other.wake;
+    on_wake = std::move(other.on_wake);
+    if (other.pprev) {
+        parent->remove(&other);
+        parent->add(this);
+    }
+    return *this;
+}
 io::timer::timer_element::~timer_element()
 {
     if(parent) parent->remove(this);
@@ -73,19 +209,18 @@ void io::timer::timer_element::setCallback(io::timer::timer_element::callback_t
     on_wake = std::move(t);
 }
 void io::timer::timer_element::setParent(timer_service* parent){
+    if (this->parent) this->parent->remove(this);
     this->parent = parent;
 }
 void io::timer::timer_element::recharge(clock_t::duration duration)
 {
     if(!parent) return;
-    parent->remove(this);
     wake = clock_t::now()+duration;
     parent->add(this);
 }
 void io::timer::timer_element::recharge(clock_t::time_point point)
 {
     if(!parent) return;
-    parent->remove(this);
     wake = point;
     parent->add(this);
 }
@@ -94,3 +229,7 @@ void io::timer::timer_element::turnOff()
     if(!parent) return;
     parent->remove(this);
 }
+bool io::timer::timer_element::armed() const
+{
+    return pprev != nullptr;
+}
@@ -5,27 +5,51 @@
 #ifndef POLL_EVENT_TIMERS_H
 #define POLL_EVENT_TIMERS_H
 #include <chrono>
-#include <map>
+#include <cstdint>
 #include <functional>
 namespace io
 {
     namespace timer
     {
     class timer_element;
+        // Hierarchical timing wheel with millisecond ticks: WHEEL_LEVELS levels of
+        // WHEEL_SLOTS slots, level L slot spans WHEEL_SLOTS^L ticks. Elements are
+        // intrusive, so add/remove/recharge are O(1) and never allocate.
         class timer_service
         {
         public:
 
             typedef std::chrono::steady_clock clock_t;
+            typedef uint64_t tick_t;
+            static const size_t WHEEL_BITS = 8;
+            static const size_t WHEEL_SLOTS = 1 << WHEEL_BITS;
+            static const size_t WHEEL_LEVELS = 4;
             timer_service();
+            timer_service(const timer_service&) = delete;
+            timer_service& operator=(const timer_service&) = delete;
             void add(timer_element*);
             void remove(timer_element*);
             bool empty() const;
+            size_t size() const;
             clock_t::time_point top() const;
             void process(clock_t::time_point);
         private:
-            std::map<clock_t::time_point,timer_element*> queue;
-
+            struct level
+            {
+                timer_element *slots[WHEEL_SLOTS];
+                uint64_t occupied[WHEEL_SLOTS / 64];
+                size_t count;
+            };
+            tick_t to_tick(clock_t::time_point, bool ceil) const;
+            void link(timer_element*);
+            void unlink(timer_element*);
+            void cascade(size_t lvl);
+            void expire();
+            size_t first_occupied(const level &, size_t from) const;
+            clock_t::time_point origin;
+            tick_t current = 0;
+            size_t total = 0;
+            level wheel[WHEEL_LEVELS];
         };
         class timer_element
         {
@@ -36,16 +60,26 @@ namespace io
             timer_element(callback_t);
             timer_element(timer_service&,clock_t::duration,callback_t);
             timer_element(timer_service&,clock_t::time_point,callback_t);
+            timer_element(const timer_element&) = delete;
+            timer_element& operator=(const timer_element&) = delete;
+            timer_element(timer_element&&);
+            timer_element& operator=(timer_element&&);
             ~timer_element();
             void setCallback(callback_t);
             void setParent(timer_service*);
             void recharge(clock_t::duration);
             void turnOff();
             void recharge(clock_t::time_point);
+            bool armed() const;
         private:
             timer_service *parent;
             clock_t::time_point wake;
             callback_t on_wake;
+            timer_service::tick_t expires = 0;
+            timer_element *next = nullptr;
+            timer_element **pprev = nullptr;
+            uint8_t level = 0;
+            uint8_t slot = 0;
             friend class timer_service;
         };
     }
@@ -0,0 +1,75 @@
+#include "upstream_pool.h"
+#include "debug.h"
+
+upstream_pool::upstream_pool(io::io_service &ios, size_t maxIdle, size_t maxPerHost, duration idleTimeout)
+    : ios(&ios), maxIdle(maxIdle), maxPerHost(maxPerHost), idleTimeout(idleTimeout)
+{
+}
+uint64_t upstream_pool::key(const ipv4_endpoint &endpoint)
+{
+    return (static_cast<uint64_t>(endpoint.addrnet()) << 16) | endpoint.iport();
+}
+std::unique_ptr<connection> upstream_pool::checkout(const ipv4_endpoint &endpoint)
+{
+    auto it = hosts.find(key(endpoint));
+    while (it != hosts.end() && !it->second.empty()) {
+        idle_connection *entry = it->second.front();
+        std::unique_ptr<connection> socket = std::move(entry->socket);
+        evict(entry); // may erase `it` when the host list becomes empty
+        if (socket->is_open()) {
+            socket->sleep();
+            LOG("(%d):Reusing pooled connection to %s", socket->getFd().get_raw(), endpoint.to_string().c_str());
+            return socket;
+        }
+        it = hosts.find(key(endpoint));
+    }
+    return nullptr;
+}
+void upstream_pool::release(const ipv4_endpoint &endpoint, std::unique_ptr<connection> socket)
+{
+    if (maxIdle == 0 || maxPerHost == 0) return;
+    uint64_t k = key(endpoint);
+    auto &host = hosts[k];
+    if (host.size() >= maxPerHost) {
+        evict(host.back());
+    }
+    else if (idle.size() >= maxIdle) {
+        evict(&idle.back());
+    }
+    auto &hostList = hosts[k]; // the previous reference may be gone after evict()
+    if (spareEntries.empty()) idle.emplace_front();
+    else idle.splice(idle.begin(), spareEntries, spareEntries.begin());
+    idle_connection *entry = &idle.front();
+    entry->key = k;
+    entry->socket = std::move(socket);
+    entry->self = idle.begin();
+    if (spareLinks.empty()) hostList.push_front(entry);
+    else hostList.splice(hostList.begin(), spareLinks, spareLinks.begin());
+    hostList.front() = entry;
+    entry->inHost = hostList.begin();
+    entry->timer = io::timer::timer_element(ios->getClock(), idleTimeout, [this, entry]()
+    {
+        LOG("(%d):Pooled connection expired", entry->socket->getFd().get_raw());
+        evict(entry);
+    });
+    // Nothing is expected from an idle origin: data, EOF or an error all retire it.
+    entry->socket->setOn_disconnect([this, entry]()
+                                    { evict(entry); });
+    entry->socket->setOn_rw([this, entry]()
+                            { evict(entry); }, connection::callback());
+    LOG("(%d):Pooled connection to %s", entry->socket->getFd().get_raw(), endpoint.to_string().c_str());
+}
+void upstream_pool::evict(idle_connection *entry)
+{
+    auto host = hosts.find(entry->key);
+    spareLinks.splice(spareLinks.begin(), host->second, entry->inHost);
+    // empty lists are kept for hosts seen again, up to one per idle connection allowed
+    if (host->second.empty() && hosts.size() > maxIdle) hosts.erase(host);
+    entry->timer.turnOff();
+    entry->socket.reset();
+    spareEntries.splice(spareEntries.begin(), idle, entry->self);
+}
+size_t upstream_pool::size() const
+{
+    return idle.size();
+}
@@ -0,0 +1,46 @@
+#ifndef POLL_EVENT_UPSTREAM_POOL_H
+#define POLL_EVENT_UPSTREAM_POOL_H
+
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include "connection.h"
+#include "address.h"
+#include "timer.h"
+
+// Idle keep-alive connections to origins, keyed by resolved endpoint. A
+// connection is owned by exactly one outbound while a request is in flight
+// and by the pool between requests. Belongs to one io_service.
+class upstream_pool
+{
+public:
+    typedef io::timer::timer_service::clock_t::duration duration;
+    upstream_pool(io::io_service &, size_t maxIdle, size_t maxPerHost, duration idleTimeout);
+    std::unique_ptr<connection> checkout(const ipv4_endpoint &);
+    void release(const ipv4_endpoint &, std::unique_ptr<connection>);
+    size_t size() const;
+private:
+    struct idle_connection
+    {
+        uint64_t key;
+        std::unique_ptr<connection> socket;
+        io::timer::timer_element timer;
+        std::list<idle_connection>::iterator self;
+        std::list<idle_connection *>::iterator inHost;
+    };
+    static uint64_t key(const ipv4_endpoint &);
+    void evict(idle_connection *);
+    io::io_service *ios;
+    size_t maxIdle;
+    size_t maxPerHost;
+    duration idleTimeout;
+    std::list<idle_connection> idle; // most recently released first
+    std::unordered_map<uint64_t, std::list<idle_connection *>> hosts;
+    // Nodes of evicted entries, spliced back in by release(): a connection
+    // going back and forth between requests and the pool doesn't allocate
+    std::list<idle_connection> spareEntries;
+    std::list<idle_connection *> spareLinks;
+};
+
+
+#endif //POLL_EVENT_UPSTREAM_POOL_H
@@ -18,12 +18,25 @@ str_to_uint16(const char *str, uint16_t *res)
     *res = (uint16_t) val;
     return true;
 }
+bool str_to_size(const char *str, size_t length, size_t *res)
+{
+    if (length == 0) return false;
+    size_t val = 0;
+    for (size_t i = 0; i < length; i++) {
+        if (str[i] < '0' || str[i] > '9') return false;
+        size_t digit = static_cast<size_t>(str[i] - '0');
+        if (val > (SIZE_MAX - digit) / 10) return false;
+        val = val * 10 + digit;
+    }
+    *res = val;
+    return true;
+}
 const std::string currentDateTime()
 {
     time_t now = time(0);
     struct tm tstruct;
     char buf[80];
-    tstruct = *localtime(&now);
+    localtime_r(&now, &tstruct);
     strftime(buf, sizeof(buf), "%Y-%m-%d.%X", &tstruct);
 
     return buf;
@@ -33,11 +46,20 @@ const std::string currentTime()
     time_t now = time(0);
     struct tm tstruct;
     char buf[80];
-    tstruct = *localtime(&now);
+    localtime_r(&now, &tstruct);
     strftime(buf, sizeof(buf), "%X", &tstruct);
 
     return buf;
 }
+bool parse_http_date(const std::string &text, time_t *res)
+{
+    struct tm parsed;
+    memset(&parsed, 0, sizeof(parsed));
+    const char *end = strptime(text.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &parsed);
+    if (!end || *end != '\0') return false;
+    *res = timegm(&parsed);
+    return true;
+}
 int getSocketError(const handle& fd)
 {
     int error = 0;
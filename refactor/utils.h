@@ -5,16 +5,20 @@
 #ifndef POLL_EVENT_UTILS_H
 #define POLL_EVENT_UTILS_H
 #include <inttypes.h>
-#include <bits/errno.h>
+#include <errno.h>
 #include <time.h>
 #include <string>
 #include <cerrno>
 #include "handle.h"
 bool
 str_to_uint16(const char *str, uint16_t *res);
+// Digits only: no sign, no spaces, nothing that doesn't fit
+bool str_to_size(const char *str, size_t length, size_t *res);
 const std::string currentDateTime();
 int getSocketError(const handle& fd);
 const std::string currentTime();
+// IMF-fixdate ("Sun, 06 Nov 1994 08:49:37 GMT"), the only format senders may generate
+bool parse_http_date(const std::string &text, time_t *res);
 
 
 #endif //POLL_EVENT_UTILS_H
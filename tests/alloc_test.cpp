@@ -0,0 +1,167 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <new>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "../refactor/io_service.h"
+#include "../refactor/proxy_server.h"
+
+// Counts heap allocations the proxy's loop makes per request once it is warm:
+// a client pipelines GETs through the proxy to an origin on this host, both
+// on threads of their own, and only the loop thread's allocations count.
+namespace
+{
+    const size_t warmup = 200;
+    const size_t measured = 2000;
+    const size_t depth = 8; // requests pipelined per batch
+    // Parse state and the forwarded request text live in recycled arenas,
+    // reads and the copies of small ones in pooled buffers, response text in
+    // the last response's string and queues in vectors that keep their room
+    const double allowed = 0;
+
+    std::atomic<bool> measuring{false};
+    thread_local bool loopThread = false;
+    std::atomic<size_t> allocations{0};
+
+    // the exchanges are small writes waiting on each other, Nagle would add delayed ACKs
+    void noDelay(int fd)
+    {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof one);
+    }
+    int listenLocal(uint16_t *port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof addr;
+        if (fd == -1 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == -1 || listen(fd, 16) == -1
+            || getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) == -1) {
+            perror("origin");
+            exit(1);
+        }
+        *port = ntohs(addr.sin_port);
+        return fd;
+    }
+    int connectLocal(uint16_t port)
+    {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = htons(port);
+        if (fd == -1 || connect(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == -1) {
+            perror("client");
+            exit(1);
+        }
+        noDelay(fd);
+        return fd;
+    }
+    // Answers every request head on a connection with a small keep-alive response
+    void serveOrigin(int fd)
+    {
+        noDelay(fd);
+        static const char answer[] = "HTTP/1.1 200 OK\r\nContent-Length: 5\r\n\r\nhello";
+        std::string pending;
+        char buffer[16 * 1024];
+        ssize_t res;
+        while ((res = read(fd, buffer, sizeof buffer)) > 0) {
+            pending.append(buffer, res);
+            size_t end;
+            while ((end = pending.find("\r\n\r\n")) != pending.npos) {
+                pending.erase(0, end + 4);
+                if (write(fd, answer, sizeof answer - 1) == -1) break;
+            }
+        }
+        close(fd);
+    }
+    void runOrigin(int listener)
+    {
+        for (;;) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd == -1) return;
+            std::thread(serveOrigin, fd).detach();
+        }
+    }
+    // Sends `count` requests in pipelined batches and waits for every response
+    void exchange(int fd, uint16_t origin, size_t count)
+    {
+        std::string host = "127.0.0.1:" + std::to_string(origin);
+        std::string batch;
+        for (size_t i = 0; i < depth; i++) {
+            batch += "GET http://" + host + "/object/" + std::to_string(i) + " HTTP/1.1\r\nHost: " + host
+                + "\r\nUser-Agent: alloc_test\r\nAccept: */*\r\n\r\n";
+        }
+        char buffer[16 * 1024];
+        for (size_t sent = 0; sent < count; sent += depth) {
+            if (write(fd, batch.data(), batch.size()) != static_cast<ssize_t>(batch.size())) {
+                perror("client write");
+                exit(1);
+            }
+            size_t answered = 0;
+            std::string received;
+            while (answered < depth) {
+                ssize_t res = read(fd, buffer, sizeof buffer);
+                if (res <= 0) {
+                    printf("FAILED: the proxy closed the connection after %lu requests\n", sent + answered);
+                    exit(1);
+                }
+                received.append(buffer, res);
+                size_t end;
+                while ((end = received.find("\r\n\r\nhello")) != received.npos) {
+                    received.erase(0, end + 9);
+                    answered++;
+                }
+            }
+        }
+    }
+}
+
+void *operator new(size_t size)
+{
+    if (loopThread && measuring.load(std::memory_order_relaxed)) allocations++;
+    if (void *p = malloc(size ? size : 1)) return p;
+    throw std::bad_alloc();
+}
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+int main()
+{
+    uint16_t originPort;
+    int listener = listenLocal(&originPort);
+    std::thread(runOrigin, listener).detach();
+
+    loopThread = true;
+    io::io_service ep;
+    proxy_server server(ep, ipv4_endpoint(0, ipv4_address("127.0.0.1")));
+    uint16_t proxyPort = server.local_endpoint().port();
+
+    std::thread client([&server, originPort, proxyPort]
+                       {
+                           int fd = connectLocal(proxyPort);
+                           exchange(fd, originPort, warmup);
+                           measuring = true;
+                           exchange(fd, originPort, measured);
+                           measuring = false;
+                           close(fd);
+                           server.shutdown();
+                       });
+    ep.run();
+    client.join();
+
+    double perRequest = static_cast<double>(allocations) / measured;
+    printf("%lu allocations for %lu requests: %.2f per request (allowed %.0f)\n",
+           allocations.load(), measured, perRequest, allowed);
+    return perRequest <= allowed ? 0 : 1;
+}
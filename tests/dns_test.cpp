@@ -0,0 +1,186 @@
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <netinet/in.h>
+#include <set>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include "../refactor/dns_client.h"
+
+// Resolves names against a stub nameserver on this host, running on a thread
+// of its own. The name decides the reply: an address behind a CNAME, NXDOMAIN,
+// silence, or a truncated packet with and without a usable record in it.
+namespace
+{
+    std::atomic<size_t> silentQueries{0};
+    std::atomic<size_t> answerQueries{0};
+    std::mutex portsMutex;
+    std::set<uint16_t> sourcePorts;
+
+    void fail(const std::string &what)
+    {
+        printf("FAILED: %s\n", what.c_str());
+        exit(1);
+    }
+    std::string name_of(const std::string &query)
+    {
+        std::string name;
+        for (size_t pos = 12; pos < query.size() && query[pos];) {
+            size_t len = static_cast<unsigned char>(query[pos]);
+            if (!name.empty()) name += '.';
+            name.append(query, pos + 1, len);
+            pos += len + 1;
+        }
+        return name;
+    }
+    void put16(std::string &out, uint16_t value)
+    {
+        out.push_back(static_cast<char>(value >> 8));
+        out.push_back(static_cast<char>(value & 0xFF));
+    }
+    void put32(std::string &out, uint32_t value)
+    {
+        put16(out, static_cast<uint16_t>(value >> 16));
+        put16(out, static_cast<uint16_t>(value & 0xFFFF));
+    }
+    // header and question of the reply; the question is echoed as it came
+    std::string reply(const std::string &query, size_t questionEnd, uint16_t flags, uint16_t answers)
+    {
+        std::string out = query.substr(0, 2);
+        put16(out, flags);
+        put16(out, 1);
+        put16(out, answers);
+        put16(out, 0);
+        put16(out, 0);
+        out.append(query, 12, questionEnd - 12);
+        return out;
+    }
+    void a_record(std::string &out, uint32_t ttl, const char *address)
+    {
+        put16(out, 0xC00C); // the question's name
+        put16(out, 1);
+        put16(out, 1);
+        put32(out, ttl);
+        put16(out, 4);
+        in_addr addr;
+        inet_pton(AF_INET, address, &addr);
+        out.append(reinterpret_cast<char *>(&addr), 4);
+    }
+    void serve(int fd)
+    {
+        char buffer[512];
+        sockaddr_in from;
+        socklen_t length = sizeof from;
+        ssize_t size;
+        while ((size = recvfrom(fd, buffer, sizeof buffer, 0, reinterpret_cast<sockaddr *>(&from), &length)) > 0) {
+            {
+                std::lock_guard<std::mutex> lock(portsMutex);
+                sourcePorts.insert(ntohs(from.sin_port));
+            }
+            std::string query(buffer, size);
+            std::string name = name_of(query);
+            size_t questionEnd = 12 + name.size() + 2 + 4;
+            std::string out;
+            if (name == "answer.test") {
+                answerQueries++;
+                out = reply(query, questionEnd, 0x8180, 2);
+                put16(out, 0xC00C); // CNAME to the question's name, fresher than the A record
+                put16(out, 5);
+                put16(out, 1);
+                put32(out, 300);
+                put16(out, 2);
+                put16(out, 0xC00C);
+                a_record(out, 60, "10.1.2.3");
+            }
+            else if (name == "missing.test") {
+                out = reply(query, questionEnd, 0x8183, 0);
+            }
+            else if (name == "silent.test") {
+                silentQueries++;
+                continue;
+            }
+            else if (name == "truncated.test") {
+                out = reply(query, questionEnd, 0x8380, 2); // TC, the records did not fit
+            }
+            else if (name == "cut.test") {
+                out = reply(query, questionEnd, 0x8380, 2); // TC, the first record made it
+                a_record(out, 30, "10.4.5.6");
+                out.append("\xC0\x0C\x00\x01", 4);
+            }
+            else {
+                out = reply(query, questionEnd, 0x8182, 0);
+            }
+            sendto(fd, out.data(), out.size(), 0, reinterpret_cast<sockaddr *>(&from), length);
+            length = sizeof from;
+        }
+    }
+    uint16_t start_nameserver()
+    {
+        int fd = socket(AF_INET, SOCK_DGRAM, 0);
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof addr;
+        if (fd == -1 || bind(fd, reinterpret_cast<sockaddr *>(&addr), sizeof addr) == -1
+            || getsockname(fd, reinterpret_cast<sockaddr *>(&addr), &length) == -1) {
+            perror("nameserver");
+            exit(1);
+        }
+        std::thread(serve, fd).detach();
+        return ntohs(addr.sin_port);
+    }
+}
+
+int main()
+{
+    uint16_t port = start_nameserver();
+    io::io_service ep;
+    std::map<std::string, dns_client::answer> answers;
+    dns_client client(ep, ipv4_endpoint(port, ipv4_address("127.0.0.1")), [&answers](const dns_client::answer &a)
+    {
+        answers.insert({a.host, a});
+    });
+    // the loop only gives up once it is idle and nothing is in flight
+    ep.setCallback([&client] { return client.inflight() == 0 ? 1 : 0; });
+
+    const char *hosts[] = {"answer.test", "answer.test:8080", "missing.test", "silent.test",
+                           "truncated.test", "cut.test", "10.9.9.9:81"};
+    for (auto host : hosts) client.resolve(host);
+    ep.run();
+
+    for (auto host : hosts) {
+        if (!answers.count(host)) fail(std::string("no answer for ") + host);
+    }
+    auto &plain = answers["answer.test"], &withPort = answers["answer.test:8080"];
+    if (!plain.resolved || plain.resolved->to_string() != "10.1.2.3:80") fail("answer.test did not resolve");
+    if (!withPort.resolved || withPort.resolved->to_string() != "10.1.2.3:8080") fail("the port was lost");
+    if (plain.ttl != 60) fail("a CNAME chain is cached past its A record");
+    if (answerQueries != 1) fail("one name was queried more than once");
+
+    auto &missing = answers["missing.test"];
+    if (missing.resolved || missing.ttl == 0) fail("NXDOMAIN is not cached as a failure");
+
+    auto &silent = answers["silent.test"];
+    if (silent.resolved || silent.ttl != 0) fail("a timeout was cached");
+    if (silentQueries != 3) fail("expected 3 attempts, saw " + std::to_string(silentQueries.load()));
+
+    auto &truncated = answers["truncated.test"];
+    if (truncated.resolved || truncated.ttl != 0) fail("a truncated reply without records was cached");
+    auto &cut = answers["cut.test"];
+    if (!cut.resolved || cut.resolved->to_string() != "10.4.5.6:80" || cut.ttl != 30) {
+        fail("the record a truncated reply still carried was lost");
+    }
+
+    // five names were queried, each from a socket of its own
+    if (sourcePorts.size() != 5) fail("expected 5 source ports, saw " + std::to_string(sourcePorts.size()));
+
+    auto &literal = answers["10.9.9.9:81"];
+    if (!literal.resolved || literal.resolved->to_string() != "10.9.9.9:81") fail("an address literal was looked up");
+    printf("dns_client: %lu answers checked\n", answers.size());
+    return 0;
+}
@@ -0,0 +1,51 @@
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include "../refactor/HTTP.h"
+
+// Whether requests and responses keep their connection open, by version and
+// Connection options. Options are tokens in any case, possibly in a list.
+namespace
+{
+    size_t failures = 0;
+
+    std::string head(const char *firstLine, const char *connection)
+    {
+        std::string text = std::string(firstLine) + "\r\nHost: example.com\r\nContent-Length: 0\r\n";
+        if (*connection) text += std::string("Connection: ") + connection + "\r\n";
+        return text + "\r\n";
+    }
+    void check(const char *what, const char *connection, bool expected, bool got)
+    {
+        if (expected == got) return;
+        printf("FAILED: %s with Connection: \"%s\" should %s\n", what, connection,
+               expected ? "keep alive" : "close");
+        failures++;
+    }
+    void expect(const char *version, const char *connection, bool keepAlive)
+    {
+        std::string status = std::string(version) + " 200 OK";
+        std::string line = std::string("GET http://example.com/ ") + version;
+        check(status.c_str(), connection, keepAlive, response(head(status.c_str(), connection)).is_keep_alive());
+        check(line.c_str(), connection, keepAlive, request(head(line.c_str(), connection)).is_keep_alive());
+    }
+}
+
+int main()
+{
+    expect("HTTP/1.1", "", true);
+    expect("HTTP/1.1", "close", false);
+    expect("HTTP/1.1", "Close", false);
+    expect("HTTP/1.1", "CLOSE", false);
+    expect("HTTP/1.1", "Upgrade, close", false);
+    expect("HTTP/1.1", "keep-alive , Close ", false);
+    expect("HTTP/1.1", "closed", true);
+    expect("HTTP/1.0", "", false);
+    expect("HTTP/1.0", "keep-alive", true);
+    expect("HTTP/1.0", "Keep-Alive", true);
+    expect("HTTP/1.0", "TE, Keep-Alive", true);
+    expect("HTTP/1.0", "Keep-Alive, close", false);
+    if (failures) return 1;
+    printf("keep-alive: all cases pass\n");
+    return 0;
+}
@@ -0,0 +1,50 @@
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include "../refactor/metrics.h"
+
+// Values on and next to bucket boundaries, exported in Prometheus text:
+// every value must be counted by the first bucket whose le it does not exceed.
+namespace
+{
+    size_t failures = 0;
+
+    // The cumulative count exported for `le`, or -1 if there is no such bucket
+    long long bucket(const std::string &exposition, const std::string &le)
+    {
+        std::string key = "latency_bucket{le=\"" + le + "\"} ";
+        size_t pos = exposition.find(key);
+        if (pos == exposition.npos) return -1;
+        return std::stoll(exposition.substr(pos + key.size()));
+    }
+    void expect(const std::string &exposition, const std::string &le, long long count)
+    {
+        long long got = bucket(exposition, le);
+        if (got == count) return;
+        printf("FAILED: le=\"%s\" counts %lld, expected %lld\n", le.c_str(), got, count);
+        failures++;
+    }
+}
+
+int main()
+{
+    histogram h;
+    const uint64_t values[] = {7, 8, 15, 16, 1023, 1024};
+    for (uint64_t micros : values) h.record(micros);
+    std::ostringstream out;
+    h.write(out, "latency", "");
+    std::string text = out.str();
+
+    expect(text, "0.000007", 1);
+    expect(text, "0.000015", 3);
+    expect(text, "0.000031", 4);
+    expect(text, "0.001023", 5);
+    expect(text, "0.002047", 6);
+    expect(text, "+Inf", 6);
+    if (failures) {
+        printf("%s", text.c_str());
+        return 1;
+    }
+    printf("histogram: bucket bounds are inclusive\n");
+    return 0;
+}